@@ -0,0 +1,138 @@
+/*
+ * This file contains the definitions of structures and functions implementing
+ * a simple arena allocator.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Every allocation is rounded up to this many bytes so that the next one is
+ * suitably aligned for any object (pointers, doubles, 64-bit integers).
+ */
+#define ARENA_ALIGN 16
+
+static size_t arena_round(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/*
+ * Initializes an empty arena.
+ */
+void arena_init(struct arena* arena, size_t chunk_size) {
+  assert(arena);
+  arena->chunks = NULL;
+  arena->chunk_size = arena_round(chunk_size);
+  memset(&arena->pages, 0, sizeof(arena->pages));
+}
+
+/*
+ * Initializes an empty arena with page-backed chunks.
+ */
+void arena_init_pages(struct arena* arena, size_t chunk_size, const struct page_options* pages) {
+  arena_init(arena, chunk_size);
+  if (pages != NULL) {
+    arena->pages = *pages;
+  }
+}
+
+/*
+ * Frees one chunk and its memory.
+ */
+static void arena_chunk_free(struct arena_chunk* chunk) {
+  if (chunk->mapped > 0) {
+    page_free(chunk->data, chunk->mapped);
+  } else {
+    free(chunk->data);
+  }
+  free(chunk);
+}
+
+/*
+ * Adds a new chunk of at least min_size bytes at the front of the chunk list.
+ */
+static struct arena_chunk* arena_grow(struct arena* arena, size_t min_size) {
+  size_t size = arena->chunk_size > min_size ? arena->chunk_size : min_size;
+  struct arena_chunk* chunk = malloc(sizeof(struct arena_chunk));
+  assert(chunk);
+  if (page_options_set(&arena->pages)) {
+    chunk->data = page_alloc(size, &arena->pages, &chunk->mapped);
+  } else {
+    chunk->data = malloc(size);
+    chunk->mapped = 0;
+  }
+  assert(chunk->data);
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  return chunk;
+}
+
+/*
+ * Allocates size bytes from the current chunk, starting a new one if needed.
+ */
+void* arena_alloc(struct arena* arena, size_t size) {
+  assert(arena);
+  size = arena_round(size);
+  struct arena_chunk* chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk = arena_grow(arena, size);
+  }
+  void* ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+/*
+ * Keeps the newest chunk and frees the rest.
+ */
+void arena_reset(struct arena* arena) {
+  assert(arena);
+  struct arena_chunk* keep = arena->chunks;
+  if (keep == NULL) {
+    return;
+  }
+  struct arena_chunk* current = keep->next;
+  while (current != NULL) {
+    struct arena_chunk* next = current->next;
+    arena_chunk_free(current);
+    current = next;
+  }
+  keep->next = NULL;
+  keep->used = 0;
+}
+
+/*
+ * Appends from's chunks behind arena's, so arena keeps allocating from its
+ * own current chunk.
+ */
+void arena_merge(struct arena* arena, struct arena* from) {
+  assert(arena);
+  assert(from);
+  if (arena->chunks == NULL) {
+    arena->chunks = from->chunks;
+  } else {
+    struct arena_chunk* tail = arena->chunks;
+    while (tail->next != NULL) {
+      tail = tail->next;
+    }
+    tail->next = from->chunks;
+  }
+  from->chunks = NULL;
+}
+
+/*
+ * Frees every chunk of the arena.
+ */
+void arena_release(struct arena* arena) {
+  assert(arena);
+  arena_reset(arena);
+  if (arena->chunks != NULL) {
+    arena_chunk_free(arena->chunks);
+    arena->chunks = NULL;
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * This file contains the definition of an interface for a simple arena
+ * (bump) allocator.  Memory is carved out of large chunks and is only given
+ * back all at once, which makes it cheap to allocate many small objects that
+ * share a lifetime.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+#include "page_alloc.h"
+
+/*
+ * One contiguous block of arena memory.  mapped is the length of the
+ * mapping for page-backed chunks, 0 for malloc'd ones.
+ */
+struct arena_chunk {
+  struct arena_chunk* next;
+  size_t size;
+  size_t used;
+  size_t mapped;
+  char* data;
+};
+
+/*
+ * Structure used to represent an arena.  Chunks are malloc'd, or allocated
+ * with page_alloc() when pages asks for huge pages or NUMA placement.
+ */
+struct arena {
+  struct arena_chunk* chunks;
+  size_t chunk_size;
+  struct page_options pages;
+};
+
+/*
+ * Initializes an empty arena whose chunks will be chunk_size bytes (requests
+ * larger than that get a chunk of their own).
+ */
+void arena_init(struct arena* arena, size_t chunk_size);
+
+/*
+ * Like arena_init(), but chunks are page-backed and placed as described by
+ * pages (see page_alloc()).  chunk_size should be a multiple of
+ * PAGE_HUGE_SIZE when huge pages are requested.
+ */
+void arena_init_pages(struct arena* arena, size_t chunk_size, const struct page_options* pages);
+
+/*
+ * Allocates size bytes, aligned for any object type, from the arena.
+ *
+ * Return:
+ *   a pointer to the memory, which stays valid until arena_reset() or
+ *   arena_release() is called
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+/*
+ * Makes all memory in the arena available again.  The most recently created
+ * chunk is kept for reuse, all others are freed.
+ */
+void arena_reset(struct arena* arena);
+
+/*
+ * Moves every chunk of from into arena, leaving from empty.  Memory handed
+ * out by from stays valid and is now released together with arena.  Used to
+ * combine arenas that were filled by different threads.
+ */
+void arena_merge(struct arena* arena, struct arena* from);
+
+/*
+ * Frees all of the memory associated with an arena.
+ */
+void arena_release(struct arena* arena);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * This file contains the definitions of functions implementing a blocked
+ * counting Bloom filter.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "page_alloc.h"
+#include "bloom.h"
+
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_COUNTER_MAX 15
+
+/*
+ * Counters per element at the requested capacity.  With 4 probes in 128
+ * counter blocks this keeps false positives near 2%.
+ */
+#define BLOOM_COUNTERS_PER_ELEMENT 12
+
+struct bloom_filter* bloom_create(size_t capacity, const struct page_options* pages) {
+  struct bloom_filter* filter = malloc(sizeof(struct bloom_filter));
+  assert(filter);
+  size_t blocks_needed = capacity / (128 / BLOOM_COUNTERS_PER_ELEMENT) + 1;
+  filter->num_blocks = 1;
+  while (filter->num_blocks < blocks_needed) {
+    filter->num_blocks *= 2;
+  }
+  assert(filter->num_blocks <= (SIZE_MAX - 64) / (BLOOM_BLOCK_WORDS * sizeof(uint64_t)));
+  size_t bytes = filter->num_blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+  filter->block = page_alloc(bytes + 64, pages, &filter->mapped);
+  assert(filter->block);
+  filter->blocks = (uint64_t*) (((uintptr_t) filter->block + 63) & ~(uintptr_t) 63);
+  return filter;
+}
+
+void bloom_free(struct bloom_filter* filter) {
+  if (filter == NULL) {
+    return;
+  }
+  page_free(filter->block, filter->mapped);
+  free(filter);
+}
+
+void bloom_clear(struct bloom_filter* filter) {
+  memset(filter->blocks, 0, filter->num_blocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+}
+
+/*
+ * The low bits of the hash pick the block and 7-bit fields of the high half
+ * pick the counters, so the two choices are independent.
+ */
+static uint64_t* bloom_block(const struct bloom_filter* filter, uint64_t hash) {
+  return filter->blocks + ((size_t) hash & (filter->num_blocks - 1)) * BLOOM_BLOCK_WORDS;
+}
+
+static unsigned int bloom_counter(uint64_t hash, int probe) {
+  return (unsigned int) (hash >> (32 + 7 * probe)) & 127;
+}
+
+static unsigned int bloom_get(const uint64_t* block, unsigned int counter) {
+  return (unsigned int) (block[counter / 16] >> (counter % 16 * 4)) & BLOOM_COUNTER_MAX;
+}
+
+void bloom_add(struct bloom_filter* filter, uint64_t hash) {
+  uint64_t* block = bloom_block(filter, hash);
+  for (int probe = 0; probe < BLOOM_PROBES; probe++) {
+    unsigned int counter = bloom_counter(hash, probe);
+    if (bloom_get(block, counter) < BLOOM_COUNTER_MAX) {
+      block[counter / 16] += (uint64_t) 1 << (counter % 16 * 4);
+    }
+  }
+}
+
+void bloom_remove(struct bloom_filter* filter, uint64_t hash) {
+  uint64_t* block = bloom_block(filter, hash);
+  for (int probe = 0; probe < BLOOM_PROBES; probe++) {
+    unsigned int counter = bloom_counter(hash, probe);
+    unsigned int count = bloom_get(block, counter);
+    assert(count > 0);
+    if (count < BLOOM_COUNTER_MAX) {
+      block[counter / 16] -= (uint64_t) 1 << (counter % 16 * 4);
+    }
+  }
+}
+
+int bloom_maybe(const struct bloom_filter* filter, uint64_t hash) {
+  const uint64_t* block = bloom_block(filter, hash);
+  for (int probe = 0; probe < BLOOM_PROBES; probe++) {
+    if (bloom_get(block, bloom_counter(hash, probe)) == 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,72 @@
+/*
+ * This file contains the definition of an interface for a blocked counting
+ * Bloom filter over 64-bit hashes.  It answers "definitely absent" or "maybe
+ * present" for a hash, reading one cache line either way, and supports
+ * removal because every position is a small counter rather than a bit.
+ */
+
+#ifndef __BLOOM_H
+#define __BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "page_alloc.h"
+
+/*
+ * Each hash maps to one 64-byte block of 128 4-bit counters and to
+ * BLOOM_PROBES counters inside it.  A counter that reaches 15 sticks there:
+ * it is never decremented again, so removals cannot cause false negatives.
+ */
+#define BLOOM_PROBES 4
+
+/*
+ * Structure used to represent a counting Bloom filter.  blocks points into
+ * block, aligned to a cache line, and holds num_blocks (a power of two)
+ * blocks of 8 words; mapped is block's page_alloc() mapping length.
+ */
+struct bloom_filter {
+  void* block;
+  size_t mapped;
+  uint64_t* blocks;
+  size_t num_blocks;
+};
+
+/*
+ * Creates an empty filter sized for about capacity elements, at which point
+ * it gives roughly 2% false positives.  More elements raise that rate but
+ * never cause false negatives.
+ *
+ * Params:
+ *   capacity - the expected number of elements
+ *   pages - backing and placement of the counters, may be NULL
+ */
+struct bloom_filter* bloom_create(size_t capacity, const struct page_options* pages);
+
+/*
+ * Frees a filter.
+ */
+void bloom_free(struct bloom_filter* filter);
+
+/*
+ * Removes every element from a filter.
+ */
+void bloom_clear(struct bloom_filter* filter);
+
+/*
+ * Adds a hash to a filter.
+ */
+void bloom_add(struct bloom_filter* filter, uint64_t hash);
+
+/*
+ * Removes a hash that was added before.
+ */
+void bloom_remove(struct bloom_filter* filter, uint64_t hash);
+
+/*
+ * Returns 0 if hash has definitely not been added (or has been removed as
+ * often as added), nonzero if it may have been.
+ */
+int bloom_maybe(const struct bloom_filter* filter, uint64_t hash);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * This file contains the definitions of functions implementing the search
+ * trees that index long chains of a chained hash_table.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "page_alloc.h"
+#include "hash_table_internal.h"
+#include "chain_tree.h"
+
+int chain_tree_enabled(struct hash_table* hash_table) {
+  return hash_table->array != NULL && hash_table->policy.equal == NULL;
+}
+
+/*
+ * Orders (hash, key) against an entry.  Entries with equal keys are told
+ * apart by seq only where compare_seq says so.
+ */
+static int entry_compare(uint64_t hash, const char* key, size_t seq, int compare_seq,
+                         const struct chain_tree_entry* entry) {
+  if (hash != entry->node->hash) {
+    return hash < entry->node->hash ? -1 : 1;
+  }
+  int order = key == entry->node->key ? 0 : strcmp(key, entry->node->key);
+  if (order != 0 || !compare_seq) {
+    return order;
+  }
+  return seq < entry->seq ? -1 : seq > entry->seq;
+}
+
+static int entry_height(const struct chain_tree_entry* entry) {
+  return entry == NULL ? 0 : entry->height;
+}
+
+static void entry_update(struct chain_tree_entry* entry) {
+  int left = entry_height(entry->left);
+  int right = entry_height(entry->right);
+  entry->height = (left > right ? left : right) + 1;
+}
+
+static struct chain_tree_entry* rotate_right(struct chain_tree_entry* entry) {
+  struct chain_tree_entry* pivot = entry->left;
+  entry->left = pivot->right;
+  pivot->right = entry;
+  entry_update(entry);
+  entry_update(pivot);
+  return pivot;
+}
+
+static struct chain_tree_entry* rotate_left(struct chain_tree_entry* entry) {
+  struct chain_tree_entry* pivot = entry->right;
+  entry->right = pivot->left;
+  pivot->left = entry;
+  entry_update(entry);
+  entry_update(pivot);
+  return pivot;
+}
+
+/*
+ * Restores the AVL balance at entry, whose subtrees differ in height by at
+ * most two, and returns the new root of its subtree.
+ */
+static struct chain_tree_entry* entry_balance(struct chain_tree_entry* entry) {
+  entry_update(entry);
+  int balance = entry_height(entry->left) - entry_height(entry->right);
+  if (balance > 1) {
+    if (entry_height(entry->left->left) < entry_height(entry->left->right)) {
+      entry->left = rotate_left(entry->left);
+    }
+    return rotate_right(entry);
+  }
+  if (balance < -1) {
+    if (entry_height(entry->right->right) < entry_height(entry->right->left)) {
+      entry->right = rotate_right(entry->right);
+    }
+    return rotate_left(entry);
+  }
+  return entry;
+}
+
+static struct chain_tree_entry* entry_insert(struct chain_tree_entry* root,
+                                             struct chain_tree_entry* entry) {
+  if (root == NULL) {
+    entry->left = NULL;
+    entry->right = NULL;
+    entry->height = 1;
+    return entry;
+  }
+  if (entry_compare(entry->node->hash, entry->node->key, entry->seq, 1, root) < 0) {
+    root->left = entry_insert(root->left, entry);
+  } else {
+    root->right = entry_insert(root->right, entry);
+  }
+  return entry_balance(root);
+}
+
+/*
+ * Detaches the leftmost entry of root's subtree into *min.
+ */
+static struct chain_tree_entry* entry_remove_min(struct chain_tree_entry* root,
+                                                 struct chain_tree_entry** min) {
+  if (root->left == NULL) {
+    *min = root;
+    return root->right;
+  }
+  root->left = entry_remove_min(root->left, min);
+  return entry_balance(root);
+}
+
+/*
+ * Detaches entry from root's subtree.  Entries are moved rather than having
+ * their contents copied, since chain neighbours point at them.
+ */
+static struct chain_tree_entry* entry_remove(struct chain_tree_entry* root,
+                                             struct chain_tree_entry* entry) {
+  assert(root);
+  if (root != entry) {
+    if (entry_compare(entry->node->hash, entry->node->key, entry->seq, 1, root) < 0) {
+      root->left = entry_remove(root->left, entry);
+    } else {
+      root->right = entry_remove(root->right, entry);
+    }
+    return entry_balance(root);
+  }
+  if (root->left == NULL) {
+    return root->right;
+  }
+  if (root->right == NULL) {
+    return root->left;
+  }
+  struct chain_tree_entry* successor;
+  struct chain_tree_entry* right = entry_remove_min(root->right, &successor);
+  successor->left = root->left;
+  successor->right = right;
+  return entry_balance(successor);
+}
+
+/*
+ * Returns the entry of node, which holds hash and key.  Only entries with
+ * equal keys have to be searched on both sides.
+ */
+static struct chain_tree_entry* entry_of(struct chain_tree_entry* root, const struct node* node) {
+  while (root != NULL) {
+    int order = entry_compare(node->hash, node->key, 0, 0, root);
+    if (order == 0) {
+      if (root->node == node) {
+        return root;
+      }
+      struct chain_tree_entry* found = entry_of(root->left, node);
+      return found != NULL ? found : entry_of(root->right, node);
+    }
+    root = order < 0 ? root->left : root->right;
+  }
+  return NULL;
+}
+
+/*
+ * Returns the entry holding key that is nearest the head of the chain, i.e.
+ * the one with the highest seq.
+ */
+static struct chain_tree_entry* entry_find(struct chain_tree* tree, uint64_t hash, const char* key) {
+  struct chain_tree_entry* found = NULL;
+  struct chain_tree_entry* root = tree->root;
+  while (root != NULL) {
+    int order = entry_compare(hash, key, 0, 0, root);
+    if (order == 0) {
+      found = root;
+    }
+    root = order < 0 ? root->left : root->right;
+  }
+  return found;
+}
+
+/*
+ * Builds the tree of bucket from its chain.  The head gets the highest seq.
+ */
+static void chain_treeify(struct hash_table* hash_table, size_t bucket, size_t length) {
+  if (hash_table->trees == NULL) {
+    hash_table->trees = page_alloc(hash_table->size * sizeof(struct chain_tree*),
+                                   &hash_table->pages, &hash_table->trees_mapped);
+    assert(hash_table->trees);
+  }
+  struct chain_tree* tree = malloc(sizeof(struct chain_tree));
+  assert(tree);
+  tree->root = NULL;
+  tree->head = NULL;
+  tree->count = 0;
+  tree->next_seq = length;
+  tree->bucket = bucket;
+
+  struct node** link = bucket_link(hash_table, bucket);
+  struct chain_tree_entry* prev = NULL;
+  for (struct node* node = *link; node != NULL; node = node->next) {
+    struct chain_tree_entry* entry = malloc(sizeof(struct chain_tree_entry));
+    assert(entry);
+    entry->node = node;
+    entry->link = link;
+    entry->prev = prev;
+    entry->next = NULL;
+    entry->seq = length - 1 - tree->count;
+    if (prev != NULL) {
+      prev->next = entry;
+    } else {
+      tree->head = entry;
+    }
+    tree->root = entry_insert(tree->root, entry);
+    tree->count++;
+    prev = entry;
+    link = &node->next;
+  }
+  assert(tree->count == length);
+
+  tree->next_tree = hash_table->tree_list;
+  if (tree->next_tree != NULL) {
+    tree->next_tree->pprev_tree = &tree->next_tree;
+  }
+  tree->pprev_tree = &hash_table->tree_list;
+  hash_table->tree_list = tree;
+  hash_table->trees[bucket] = tree;
+}
+
+/*
+ * Releases a tree, leaving its chain as it is.
+ */
+static void chain_untreeify(struct hash_table* hash_table, struct chain_tree* tree) {
+  struct chain_tree_entry* entry = tree->head;
+  while (entry != NULL) {
+    struct chain_tree_entry* next = entry->next;
+    free(entry);
+    entry = next;
+  }
+  *tree->pprev_tree = tree->next_tree;
+  if (tree->next_tree != NULL) {
+    tree->next_tree->pprev_tree = tree->pprev_tree;
+  }
+  hash_table->trees[tree->bucket] = NULL;
+  free(tree);
+}
+
+/*
+ * Returns the length of the chain starting at node, counting no further than
+ * limit + 1.
+ */
+static size_t chain_length(struct node* node, size_t limit) {
+  size_t length = 0;
+  for (; node != NULL && length <= limit; node = node->next) {
+    length++;
+  }
+  return length;
+}
+
+void chain_tree_inserted(struct hash_table* hash_table, size_t bucket, struct node* node) {
+  struct chain_tree* tree = bucket_tree(hash_table, bucket);
+  if (tree == NULL) {
+    size_t length = chain_length(node, CHAIN_TREEIFY_THRESHOLD);
+    if (length > CHAIN_TREEIFY_THRESHOLD) {
+      chain_treeify(hash_table, bucket, chain_length(node, SIZE_MAX - 1));
+    }
+    return;
+  }
+
+  // The new node went in front of the old head, whose link is now its next.
+  assert(node->next == tree->head->node);
+  struct chain_tree_entry* entry = malloc(sizeof(struct chain_tree_entry));
+  assert(entry);
+  entry->node = node;
+  entry->link = tree->head->link;
+  entry->prev = NULL;
+  entry->next = tree->head;
+  entry->seq = tree->next_seq++;
+  tree->head->link = &node->next;
+  tree->head->prev = entry;
+  tree->head = entry;
+  tree->root = entry_insert(tree->root, entry);
+  tree->count++;
+}
+
+struct node* chain_tree_find(struct chain_tree* tree, uint64_t hash, const char* key) {
+  struct chain_tree_entry* entry = entry_find(tree, hash, key);
+  return entry == NULL ? NULL : entry->node;
+}
+
+/*
+ * Unlinks entry's node from the chain and drops entry from the tree, which
+ * is released once it has become short.
+ */
+static void chain_tree_unlink_entry(struct hash_table* hash_table, struct chain_tree* tree,
+                                    struct chain_tree_entry* entry) {
+  *entry->link = entry->node->next;
+  if (entry->next != NULL) {
+    entry->next->link = entry->link;
+    entry->next->prev = entry->prev;
+  }
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    tree->head = entry->next;
+  }
+  tree->root = entry_remove(tree->root, entry);
+  tree->count--;
+  free(entry);
+  if (tree->count < CHAIN_UNTREEIFY_THRESHOLD) {
+    chain_untreeify(hash_table, tree);
+  }
+}
+
+struct node* chain_tree_unlink(struct hash_table* hash_table, size_t bucket,
+                               uint64_t hash, const char* key, int* head) {
+  struct chain_tree* tree = bucket_tree(hash_table, bucket);
+  assert(tree);
+  struct chain_tree_entry* entry = entry_find(tree, hash, key);
+  if (entry == NULL) {
+    return NULL;
+  }
+  struct node* node = entry->node;
+  *head = entry->prev == NULL;
+  chain_tree_unlink_entry(hash_table, tree, entry);
+  return node;
+}
+
+void chain_tree_unlink_node(struct hash_table* hash_table, size_t bucket, struct node* node) {
+  struct chain_tree* tree = bucket_tree(hash_table, bucket);
+  assert(tree);
+  struct chain_tree_entry* entry = entry_of(tree->root, node);
+  assert(entry);
+  chain_tree_unlink_entry(hash_table, tree, entry);
+}
+
+void chain_tree_scan(struct hash_table* hash_table) {
+  if (!chain_tree_enabled(hash_table)) {
+    return;
+  }
+  for (size_t i = 0; i < hash_table->size; i++) {
+    if (bucket_tree(hash_table, i) != NULL) {
+      continue;
+    }
+    struct node* head = bucket_head(hash_table, i);
+    if (chain_length(head, CHAIN_TREEIFY_THRESHOLD) > CHAIN_TREEIFY_THRESHOLD) {
+      chain_treeify(hash_table, i, chain_length(head, SIZE_MAX - 1));
+    }
+  }
+}
+
+void chain_tree_free_all(struct hash_table* hash_table) {
+  while (hash_table->tree_list != NULL) {
+    chain_untreeify(hash_table, hash_table->tree_list);
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ * This file contains the definition of the search trees that index long
+ * chains of a chained hash_table.  It is used by hash_table.c only; users of
+ * the hash table should only include hash_table.h.
+ *
+ * A bucket whose chain grows past CHAIN_TREEIFY_THRESHOLD nodes gets an AVL
+ * tree over its nodes, ordered by (hash, key), so finding or removing a key
+ * there takes O(log n) comparisons however badly the keys collide.  The
+ * chain itself stays as it is: everything that walks chains (iteration,
+ * dumps, snapshots, parallel scans) is unaffected, and the tree only adds a
+ * faster way in.
+ */
+
+#ifndef __CHAIN_TREE_H
+#define __CHAIN_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "node.h"
+#include "hash_table.h"
+
+/*
+ * A chain with more nodes than CHAIN_TREEIFY_THRESHOLD gets a tree; a tree
+ * left with fewer than CHAIN_UNTREEIFY_THRESHOLD nodes is dropped.  The gap
+ * keeps a bucket from flipping back and forth.
+ */
+#define CHAIN_TREEIFY_THRESHOLD 8
+#define CHAIN_UNTREEIFY_THRESHOLD 6
+
+/*
+ * One tree entry per chain node.  link is the pointer that refers to node
+ * (the bucket head or the previous node's next field), and prev and next are
+ * the entries of the neighbouring chain nodes, which is what lets a node be
+ * unlinked without walking the chain.  seq orders entries with equal keys:
+ * higher is nearer the head, i.e. added later.
+ */
+struct chain_tree_entry {
+  struct node* node;
+  struct node** link;
+  struct chain_tree_entry* prev;
+  struct chain_tree_entry* next;
+  struct chain_tree_entry* left;
+  struct chain_tree_entry* right;
+  size_t seq;
+  int height;
+};
+
+/*
+ * The tree of one bucket.  head is the entry of the chain's first node.
+ * Trees of a table are linked through next_tree and pprev_tree so that they
+ * can all be released without visiting every bucket.
+ */
+struct chain_tree {
+  struct chain_tree_entry* root;
+  struct chain_tree_entry* head;
+  size_t count;
+  size_t next_seq;
+  size_t bucket;
+  struct chain_tree* next_tree;
+  struct chain_tree** pprev_tree;
+};
+
+/*
+ * Returns nonzero if chains of hash_table may be treeified: chained tables
+ * whose keys compare with strcmp(), which the tree order has to agree with.
+ */
+int chain_tree_enabled(struct hash_table* hash_table);
+
+/*
+ * Called after node was pushed onto the head of bucket's chain: adds it to
+ * the bucket's tree, or treeifies the chain if it has grown too long.
+ */
+void chain_tree_inserted(struct hash_table* hash_table, size_t bucket, struct node* node);
+
+/*
+ * Returns the node nearest the head of tree's chain that holds key, or NULL.
+ */
+struct node* chain_tree_find(struct chain_tree* tree, uint64_t hash, const char* key);
+
+/*
+ * Unlinks the node nearest the head of bucket's chain that holds key from
+ * the chain and the tree, and returns it (or NULL if there is none).  *head
+ * is set to nonzero if it was the first node of the chain.  The node is not
+ * destroyed.
+ */
+struct node* chain_tree_unlink(struct hash_table* hash_table, size_t bucket,
+                               uint64_t hash, const char* key, int* head);
+
+/*
+ * Unlinks node, which must be in bucket's chain, from the chain and the
+ * tree.  The node is not destroyed.
+ */
+void chain_tree_unlink_node(struct hash_table* hash_table, size_t bucket, struct node* node);
+
+/*
+ * Builds trees for every chain that is too long, e.g. after chains were
+ * linked in bulk.
+ */
+void chain_tree_scan(struct hash_table* hash_table);
+
+/*
+ * Releases every tree of hash_table, leaving its chains as they are.
+ */
+void chain_tree_free_all(struct hash_table* hash_table);
+
+#endif
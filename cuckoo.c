@@ -0,0 +1,389 @@
+/*
+ * This file contains the definitions of functions implementing the
+ * bucketized cuckoo backend of hash_table.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "node.h"
+#include "page_alloc.h"
+#include "hash_table.h"
+#include "hash_table_internal.h"
+#include "perfect_hash.h"
+#include "cuckoo.h"
+
+/*
+ * Most buckets the insertion path search looks at before giving up and
+ * using the stash.  With 4-way buckets this covers paths of 4 or more moves.
+ */
+#define CUCKOO_SEARCH_SIZE 256
+
+/*
+ * Cuckoo hashing needs two independent, well-spread bucket choices, which
+ * the built-in hash functions cannot give (hash_function1 only looks at the
+ * first character).  Built-in policies therefore hash the whole key with the
+ * same string hash as perfect_hash, or with the table's SipHash when keyed;
+ * custom policies have their hash mixed, since they define which keys are
+ * equal.
+ */
+uint64_t cuckoo_hash(struct hash_table* hash_table, const char* key) {
+  if (hash_table->hash_kind == HASH_KIND_CUSTOM) {
+    return perfect_hash_mix((uint64_t) hash_table->policy.hash(hash_table, (char*) key));
+  }
+  if (hash_table->hash_kind == HASH_KIND_KEYED) {
+    return hash_raw_keyed(hash_table, key);
+  }
+  return perfect_hash_key(key, 0);
+}
+
+/*
+ * The first-choice bucket comes from the low bits of the hash.  The other
+ * bucket is the first one xor an offset taken from the high bits, so either
+ * bucket can be found from the other and the hash alone ("partial-key"
+ * cuckoo hashing): moving an element never needs its key.
+ */
+static size_t cuckoo_primary(struct hash_table* hash_table, uint64_t hash) {
+  return (size_t) hash & hash_table->mask;
+}
+
+static size_t cuckoo_alternate(struct hash_table* hash_table, size_t bucket, uint64_t hash) {
+  size_t offset = (size_t) ((hash >> 32) * 0x5bd1e995u) & hash_table->mask;
+  return bucket ^ (offset != 0 ? offset : 1);
+}
+
+/*
+ * Allocates n zeroed buckets aligned to a cache line.
+ */
+static void cuckoo_alloc_buckets(struct hash_table* hash_table, struct cuckoo_table* cuckoo, size_t n) {
+  assert(n <= (SIZE_MAX - 64) / sizeof(struct cuckoo_bucket));
+  cuckoo->block = page_alloc(n * sizeof(struct cuckoo_bucket) + 64, &hash_table->pages, &cuckoo->mapped);
+  assert(cuckoo->block);
+  cuckoo->buckets = (struct cuckoo_bucket*) (((uintptr_t) cuckoo->block + 63) & ~(uintptr_t) 63);
+}
+
+struct cuckoo_table* cuckoo_create(struct hash_table* hash_table) {
+  assert(hash_table->pow2);
+  struct cuckoo_table* cuckoo = malloc(sizeof(struct cuckoo_table));
+  assert(cuckoo);
+  memset(cuckoo, 0, sizeof(struct cuckoo_table));
+  cuckoo_alloc_buckets(hash_table, cuckoo, hash_table->size);
+  return cuckoo;
+}
+
+void cuckoo_clear(struct hash_table* hash_table) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  for (size_t i = 0; i < hash_table->size; i++) {
+    struct cuckoo_bucket* bucket = &cuckoo->buckets[i];
+    for (int w = 0; w < CUCKOO_WAYS; w++) {
+      if (bucket->nodes[w] != NULL) {
+        node_destroy(hash_table, bucket->nodes[w]);
+        bucket->nodes[w] = NULL;
+      }
+    }
+  }
+  struct node* temp = cuckoo->stash;
+  while (temp != NULL) {
+    struct node* next = temp->next;
+    node_destroy(hash_table, temp);
+    temp = next;
+  }
+  cuckoo->stash = NULL;
+  cuckoo->stash_used = 0;
+}
+
+void cuckoo_free(struct hash_table* hash_table) {
+  cuckoo_clear(hash_table);
+  page_free(hash_table->cuckoo->block, hash_table->cuckoo->mapped);
+  free(hash_table->cuckoo);
+  hash_table->cuckoo = NULL;
+}
+
+static int cuckoo_free_way(struct cuckoo_bucket* bucket) {
+  for (int w = 0; w < CUCKOO_WAYS; w++) {
+    if (bucket->nodes[w] == NULL) {
+      return w;
+    }
+  }
+  return -1;
+}
+
+/*
+ * One bucket reached by the path search: parent is the index of the bucket
+ * it was reached from and way the slot there whose element would move here.
+ */
+struct cuckoo_step {
+  size_t bucket;
+  int parent;
+  int way;
+};
+
+/*
+ * Returns nonzero if bucket already is on the path leading to step.
+ */
+static int cuckoo_on_path(struct cuckoo_step* steps, int step, size_t bucket) {
+  for (; step >= 0; step = steps[step].parent) {
+    if (steps[step].bucket == bucket) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Puts a node into one of its buckets, searching breadth first for the
+ * shortest chain of moves that frees a slot.
+ *
+ * Returns 1 if the node was placed, 0 if no path was found.
+ */
+static int cuckoo_place(struct hash_table* hash_table, struct node* node) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  struct cuckoo_step steps[CUCKOO_SEARCH_SIZE];
+  size_t first = cuckoo_primary(hash_table, node->hash);
+  steps[0].bucket = first;
+  steps[0].parent = -1;
+  steps[1].bucket = cuckoo_alternate(hash_table, first, node->hash);
+  steps[1].parent = -1;
+  int tail = 2;
+
+  for (int head = 0; head < tail; head++) {
+    struct cuckoo_bucket* bucket = &cuckoo->buckets[steps[head].bucket];
+    int free_way = cuckoo_free_way(bucket);
+    if (free_way >= 0) {
+      // Walk the path back, moving each element into the slot freed after it.
+      int step = head;
+      while (steps[step].parent >= 0) {
+        struct cuckoo_bucket* from = &cuckoo->buckets[steps[steps[step].parent].bucket];
+        struct cuckoo_bucket* to = &cuckoo->buckets[steps[step].bucket];
+        int way = steps[step].way;
+        to->hashes[free_way] = from->hashes[way];
+        to->nodes[free_way] = from->nodes[way];
+        from->nodes[way] = NULL;
+        cuckoo->stats.kicks++;
+        free_way = way;
+        step = steps[step].parent;
+      }
+      bucket = &cuckoo->buckets[steps[step].bucket];
+      bucket->hashes[free_way] = node->hash;
+      bucket->nodes[free_way] = node;
+      return 1;
+    }
+    for (int w = 0; w < CUCKOO_WAYS && tail < CUCKOO_SEARCH_SIZE; w++) {
+      size_t next = cuckoo_alternate(hash_table, steps[head].bucket, bucket->hashes[w]);
+      if (!cuckoo_on_path(steps, head, next)) {
+        steps[tail].bucket = next;
+        steps[tail].parent = head;
+        steps[tail].way = w;
+        tail++;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Pushes a node onto the stash.
+ */
+static void cuckoo_stash(struct cuckoo_table* cuckoo, struct node* node) {
+  node->next = cuckoo->stash;
+  cuckoo->stash = node;
+  cuckoo->stash_used++;
+}
+
+/*
+ * A custom policy's hash is a bucket index for the current size, so after a
+ * resize the cached hashes of its nodes are recomputed.
+ */
+static void cuckoo_rehash(struct hash_table* hash_table, struct node* node) {
+  if (hash_table->hash_kind == HASH_KIND_CUSTOM) {
+    node->hash = cuckoo_hash(hash_table, node->key);
+  }
+}
+
+/*
+ * Doubles the number of buckets and places every element again; those that
+ * still find no slot go to the new stash.
+ */
+static void cuckoo_grow(struct hash_table* hash_table) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  struct cuckoo_table old = *cuckoo;
+  size_t old_size = hash_table->size;
+  hash_table_set_size(hash_table, old_size * 2, 1);
+  cuckoo_alloc_buckets(hash_table, cuckoo, hash_table->size);
+  cuckoo->stash = NULL;
+  cuckoo->stash_used = 0;
+  for (size_t i = 0; i < old_size; i++) {
+    for (int w = 0; w < CUCKOO_WAYS; w++) {
+      struct node* node = old.buckets[i].nodes[w];
+      if (node == NULL) {
+        continue;
+      }
+      cuckoo_rehash(hash_table, node);
+      if (!cuckoo_place(hash_table, node)) {
+        cuckoo_stash(cuckoo, node);
+      }
+    }
+  }
+  struct node* temp = old.stash;
+  while (temp != NULL) {
+    struct node* next = temp->next;
+    cuckoo_rehash(hash_table, temp);
+    if (!cuckoo_place(hash_table, temp)) {
+      cuckoo_stash(cuckoo, temp);
+    }
+    temp = next;
+  }
+  page_free(old.block, old.mapped);
+  cuckoo->stats.grows++;
+}
+
+/*
+ * A node that finds no slot goes to the stash.  Once the stash is full and
+ * the buckets are at least half full the table grows first, since the
+ * failure is then most likely due to load rather than to colliding hashes.
+ */
+void cuckoo_insert(struct hash_table* hash_table, struct node* node) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  if (cuckoo_place(hash_table, node)) {
+    return;
+  }
+  if (cuckoo->stash_used >= CUCKOO_STASH_SIZE && hash_table->total >= hash_table->size * (CUCKOO_WAYS / 2)) {
+    cuckoo_grow(hash_table);
+    cuckoo_rehash(hash_table, node);
+    if (cuckoo_place(hash_table, node)) {
+      return;
+    }
+  }
+  cuckoo_stash(cuckoo, node);
+  cuckoo->stats.stash_inserts++;
+}
+
+/*
+ * Finds the slot holding key, whose hash is hash: returns the address of its
+ * node pointer (a bucket slot, the stash head or a stash node's next field),
+ * or NULL.  *stashed tells which kind of slot it is.
+ */
+static struct node** cuckoo_slot(struct hash_table* hash_table, const char* key, uint64_t hash,
+                                 int* stashed) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  size_t first = cuckoo_primary(hash_table, hash);
+  size_t candidates[2] = { first, cuckoo_alternate(hash_table, first, hash) };
+  *stashed = 0;
+  for (int c = 0; c < 2; c++) {
+    struct cuckoo_bucket* bucket = &cuckoo->buckets[candidates[c]];
+    for (int w = 0; w < CUCKOO_WAYS; w++) {
+      if (bucket->hashes[w] == hash && bucket->nodes[w] != NULL
+          && hash_table_equal(hash_table, bucket->nodes[w]->key, key)) {
+        return &bucket->nodes[w];
+      }
+    }
+  }
+  *stashed = 1;
+  for (struct node** link = &cuckoo->stash; *link != NULL; link = &(*link)->next) {
+    if (hash_table_match(hash_table, *link, hash, key)) {
+      return link;
+    }
+  }
+  return NULL;
+}
+
+struct node* cuckoo_find(struct hash_table* hash_table, const char* key, uint64_t hash) {
+  int stashed;
+  struct node** slot = cuckoo_slot(hash_table, key, hash, &stashed);
+  return slot != NULL ? *slot : NULL;
+}
+
+/*
+ * Empties a slot, keeping the stash count in step.
+ */
+static void cuckoo_empty_slot(struct cuckoo_table* cuckoo, struct node** slot, int stashed) {
+  if (stashed) {
+    *slot = (*slot)->next;
+    cuckoo->stash_used--;
+  } else {
+    *slot = NULL;
+  }
+}
+
+struct node* cuckoo_unlink(struct hash_table* hash_table, const char* key, uint64_t hash) {
+  int stashed;
+  struct node** slot = cuckoo_slot(hash_table, key, hash, &stashed);
+  if (slot == NULL) {
+    return NULL;
+  }
+  struct node* node = *slot;
+  cuckoo_empty_slot(hash_table->cuckoo, slot, stashed);
+  return node;
+}
+
+/*
+ * Within buckets "link" is the slot of the current node; along the stash it
+ * works as for chains, so removing the current node leaves link on the next.
+ */
+int cuckoo_iter_next(struct hash_table_iter* iter) {
+  struct hash_table* hash_table = iter->hash_table;
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  size_t bucket = iter->bucket;
+  if (bucket > hash_table->size) {
+    return 0;
+  }
+  if (bucket < hash_table->size) {
+    int way = iter->link != NULL ? (int) (iter->link - cuckoo->buckets[bucket].nodes) + 1 : 0;
+    for (; bucket < hash_table->size; bucket++, way = 0) {
+      for (; way < CUCKOO_WAYS; way++) {
+        if (cuckoo->buckets[bucket].nodes[way] != NULL) {
+          iter->bucket = bucket;
+          iter->link = &cuckoo->buckets[bucket].nodes[way];
+          iter->node = *iter->link;
+          return 1;
+        }
+      }
+    }
+    iter->bucket = hash_table->size;
+    iter->link = &cuckoo->stash;
+    iter->node = NULL;
+  }
+  if (iter->node != NULL) {
+    iter->link = &iter->node->next;
+  }
+  if (*iter->link != NULL) {
+    iter->node = *iter->link;
+    return 1;
+  }
+  iter->bucket = hash_table->size + 1;
+  iter->node = NULL;
+  return 0;
+}
+
+void cuckoo_iter_unlink(struct hash_table_iter* iter) {
+  cuckoo_empty_slot(iter->hash_table->cuckoo, iter->link, iter->bucket == iter->hash_table->size);
+}
+
+int cuckoo_bucket_nodes(struct hash_table* hash_table, size_t i, struct node** nodes) {
+  assert(i < hash_table->size);
+  struct cuckoo_bucket* bucket = &hash_table->cuckoo->buckets[i];
+  int count = 0;
+  for (int w = 0; w < CUCKOO_WAYS; w++) {
+    if (bucket->nodes[w] != NULL) {
+      nodes[count++] = bucket->nodes[w];
+    }
+  }
+  return count;
+}
+
+size_t cuckoo_displaced(struct hash_table* hash_table) {
+  struct cuckoo_table* cuckoo = hash_table->cuckoo;
+  size_t displaced = cuckoo->stash_used;
+  for (size_t i = 0; i < hash_table->size; i++) {
+    struct cuckoo_bucket* bucket = &cuckoo->buckets[i];
+    for (int w = 0; w < CUCKOO_WAYS; w++) {
+      if (bucket->nodes[w] != NULL && cuckoo_primary(hash_table, bucket->hashes[w]) != i) {
+        displaced++;
+      }
+    }
+  }
+  return displaced;
+}
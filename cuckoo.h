@@ -0,0 +1,115 @@
+/*
+ * This file contains the definition of the bucketized cuckoo backend of
+ * hash_table (HASH_TABLE_CUCKOO).  It is used by hash_table.c only; users of
+ * the hash table should only include hash_table.h.
+ *
+ * Every element lives in one of two candidate buckets of CUCKOO_WAYS slots,
+ * or in a stash list, so a lookup reads at most two buckets (one cache line
+ * each) plus the stash when it is not empty.  Elements are the same struct
+ * node as in chained tables; only their placement differs.
+ */
+
+#ifndef __CUCKOO_H
+#define __CUCKOO_H
+
+#include <stdint.h>
+
+#include "node.h"
+#include "hash_table.h"
+
+#define CUCKOO_WAYS 4
+
+/*
+ * Number of elements the stash holds before the table grows.  Growing only
+ * happens once the buckets are at least half full, so keys whose hashes
+ * collide outright (which no number of buckets can separate) end up chained
+ * in the stash instead of growing the table without bound.
+ */
+#define CUCKOO_STASH_SIZE 8
+
+/*
+ * One bucket, exactly one cache line.  hashes[w] is the cached hash of
+ * nodes[w], so slots can be compared and elements moved without touching
+ * the nodes.  A NULL node marks a free slot.
+ */
+struct cuckoo_bucket {
+  uint64_t hashes[CUCKOO_WAYS];
+  struct node* nodes[CUCKOO_WAYS];
+};
+
+/*
+ * Definition of the cuckoo_table structure.  buckets points into block,
+ * aligned to a cache line; mapped is block's page_alloc() mapping length.
+ * The number of buckets is the owning table's size, always a power of two.
+ * stash is a list linked through the nodes' next fields (unused otherwise)
+ * and stash_used its length.
+ */
+struct cuckoo_table {
+  void* block;
+  size_t mapped;
+  struct cuckoo_bucket* buckets;
+  struct node* stash;
+  size_t stash_used;
+  struct hash_table_cuckoo_stats stats;
+};
+
+/*
+ * Creates the buckets of a cuckoo table for hash_table, whose size must
+ * already be set.
+ */
+struct cuckoo_table* cuckoo_create(struct hash_table* hash_table);
+
+/*
+ * Destroys every element (see cuckoo_clear()) and frees the buckets.
+ */
+void cuckoo_free(struct hash_table* hash_table);
+
+/*
+ * Releases every element with node_destroy() and empties all buckets.
+ */
+void cuckoo_clear(struct hash_table* hash_table);
+
+/*
+ * Returns the hash of key that cuckoo tables cache in their nodes.
+ */
+uint64_t cuckoo_hash(struct hash_table* hash_table, const char* key);
+
+/*
+ * Places a node whose hash is set, growing the table if it does not fit.
+ */
+void cuckoo_insert(struct hash_table* hash_table, struct node* node);
+
+/*
+ * Returns the node holding key, whose cuckoo_hash() is hash, or NULL.
+ */
+struct node* cuckoo_find(struct hash_table* hash_table, const char* key, uint64_t hash);
+
+/*
+ * Takes the node holding key, whose cuckoo_hash() is hash, out of the table
+ * and returns it, or returns NULL if there is none.  The node is not
+ * destroyed.
+ */
+struct node* cuckoo_unlink(struct hash_table* hash_table, const char* key, uint64_t hash);
+
+/*
+ * Iteration: slot positions run over every bucket in order and then along
+ * the stash, which counts as bucket index size.  cuckoo_iter_next() advances
+ * iter to the next occupied slot, setting iter->link and iter->node, and
+ * returns 0 at the end; cuckoo_iter_unlink() empties the slot the iterator
+ * is on.
+ */
+int cuckoo_iter_next(struct hash_table_iter* iter);
+void cuckoo_iter_unlink(struct hash_table_iter* iter);
+
+/*
+ * Copies the nodes of bucket i (in slot order) into nodes, which needs room
+ * for CUCKOO_WAYS of them, and returns how many there are.
+ */
+int cuckoo_bucket_nodes(struct hash_table* hash_table, size_t i, struct node** nodes);
+
+/*
+ * Returns the number of elements that are not in their first-choice bucket.
+ */
+size_t cuckoo_displaced(struct hash_table* hash_table);
+
+#endif
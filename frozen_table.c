@@ -0,0 +1,307 @@
+/*
+ * This file contains the definitions of structures and functions implementing
+ * frozen, memory-mapped hash tables.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for mmap() and friends
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "node.h"
+#include "hash_table.h"
+#include "hash_table_internal.h"
+#include "frozen_table.h"
+
+/*
+ * Frozen file layout (native byte order):
+ *
+ *   struct frozen_header
+ *   struct frozen_entry[total]      - grouped by bucket, chain order kept;
+ *                                     placed first to keep them aligned
+ *   uint32_t bucket_start[size + 1] - bucket i owns entries
+ *                                     [bucket_start[i], bucket_start[i + 1])
+ *   key blob                        - NUL-terminated keys, addressed by offset
+ */
+#define FROZEN_MAGIC "HTFROZ3"
+#define FROZEN_BYTE_ORDER 0x01020304u
+#define FROZEN_POW2 0x1u
+
+struct frozen_header {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t size;
+  uint32_t total;
+  uint32_t hash_kind;
+  uint32_t flags;
+  uint64_t key_bytes;
+  uint64_t seed[2];
+};
+
+struct frozen_entry {
+  uint64_t hash;
+  int32_t value;
+  uint32_t key_offset;
+  uint32_t key_len;
+  uint32_t reserved;
+};
+
+/*
+ * Definition of the frozen_table structure.  "shape" is a bucket-less
+ * hash_table with the size and policy of the frozen one; it is what keys are
+ * hashed against, since hash functions only look at the table size.
+ */
+struct frozen_table {
+  void* map;
+  size_t map_size;
+  const uint32_t* bucket_start;
+  const struct frozen_entry* entries;
+  const char* keys;
+  uint64_t key_bytes;
+  struct hash_table shape;
+};
+
+/*
+ * Writes a hash_table in the frozen layout.
+ */
+int hash_table_freeze(struct hash_table* hash_table, const char* path) {
+  assert(hash_table);
+  assert(path);
+
+  // The frozen layout stores chains of int values, with 32-bit sizes and
+  // offsets only.
+  if (!hash_table->int_values || hash_table->array == NULL
+      || hash_table->size > INT32_MAX || hash_table->total > INT32_MAX) {
+    return 0;
+  }
+
+  FILE* out = fopen(path, "wb");
+  if (out == NULL) {
+    return 0;
+  }
+
+  struct frozen_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FROZEN_MAGIC, sizeof(header.magic));
+  header.byte_order = FROZEN_BYTE_ORDER;
+  header.size = (uint32_t) hash_table->size;
+  header.total = (uint32_t) hash_table->total;
+  header.hash_kind = (uint32_t) hash_table->hash_kind;
+  header.flags = hash_table->pow2 ? FROZEN_POW2 : 0;
+  header.seed[0] = hash_table->seed[0];
+  header.seed[1] = hash_table->seed[1];
+  int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+  // Entries; key offsets are assigned in the order the blob is written below.
+  uint64_t key_offset = 0;
+  for (size_t i = 0; i < hash_table->size && ok; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL && ok; temp = temp->next) {
+      struct frozen_entry entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.hash = temp->hash;
+      entry.value = temp->value[0].i;
+      entry.key_offset = (uint32_t) key_offset;
+      entry.key_len = (uint32_t) strlen(temp->key);
+      key_offset += entry.key_len + 1;
+      ok = key_offset <= UINT32_MAX && fwrite(&entry, sizeof(entry), 1, out) == 1;
+    }
+  }
+
+  // Bucket start offsets.
+  uint32_t start = 0;
+  for (size_t i = 0; i < hash_table->size && ok; i++) {
+    ok = fwrite(&start, sizeof(start), 1, out) == 1;
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      start++;
+    }
+  }
+  ok = ok && start == header.total && fwrite(&start, sizeof(start), 1, out) == 1;
+
+  // Key blob.
+  for (size_t i = 0; i < hash_table->size && ok; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL && ok; temp = temp->next) {
+      size_t len = strlen(temp->key) + 1;
+      ok = fwrite(temp->key, 1, len, out) == len;
+    }
+  }
+
+  // The key blob size is only known now; patch it into the header.
+  header.key_bytes = key_offset;
+  ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+
+  if (fclose(out) != 0) {
+    ok = 0;
+  }
+  return ok;
+}
+
+/*
+ * Checks the offsets a frozen table's lookups follow: bucket ranges must be
+ * ordered and within the entries, and every key must lie in the blob and
+ * end in a NUL.  Lookups rely on this instead of checking as they go.
+ */
+static int frozen_table_valid(const struct frozen_table* frozen_table, uint32_t size, uint32_t total) {
+  const uint32_t* bucket_start = frozen_table->bucket_start;
+  if (bucket_start[0] != 0 || bucket_start[size] != total) {
+    return 0;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    if (bucket_start[i] > bucket_start[i + 1]) {
+      return 0;
+    }
+  }
+  for (uint32_t i = 0; i < total; i++) {
+    const struct frozen_entry* entry = &frozen_table->entries[i];
+    uint64_t end = (uint64_t) entry->key_offset + entry->key_len;
+    if (end >= frozen_table->key_bytes || frozen_table->keys[end] != '\0') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Maps a frozen table file and checks that its sections fit in the file and
+ * that the offsets in them are sound.
+ */
+struct frozen_table* frozen_table_open(const char* path, const struct hash_policy* policy) {
+  assert(path);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(struct frozen_header)) {
+    close(fd);
+    return NULL;
+  }
+  size_t map_size = (size_t) st.st_size;
+  void* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  // Each section is checked against the bytes left after the ones before
+  // it, so that no sum of sizes taken from the file can wrap around.
+  const struct frozen_header* header = map;
+  uint64_t buckets_bytes = ((uint64_t) header->size + 1) * sizeof(uint32_t);
+  uint64_t entries_bytes = (uint64_t) header->total * sizeof(struct frozen_entry);
+  uint64_t remaining = map_size - sizeof(*header);
+  int sections_fit = entries_bytes <= remaining
+                     && buckets_bytes <= remaining - entries_bytes
+                     && header->key_bytes == remaining - entries_bytes - buckets_bytes;
+  if (memcmp(header->magic, FROZEN_MAGIC, sizeof(header->magic)) != 0
+      || header->byte_order != FROZEN_BYTE_ORDER
+      || header->size == 0 || header->size > INT32_MAX || header->total > INT32_MAX
+      || ((header->flags & FROZEN_POW2) && (header->size < 2 || (header->size & (header->size - 1)) != 0))
+      || !sections_fit) {
+    munmap(map, map_size);
+    return NULL;
+  }
+
+  // The table must hash exactly as the frozen one did.
+  struct hash_policy frozen_policy;
+  if (policy != NULL) {
+    frozen_policy = *policy;
+  } else if (header->hash_kind == HASH_KIND_FUNCTION1) {
+    frozen_policy = hash_policy_function1;
+  } else if (header->hash_kind == HASH_KIND_FUNCTION2) {
+    frozen_policy = hash_policy_function2;
+  } else if (header->hash_kind == HASH_KIND_KEYED) {
+    frozen_policy = hash_policy_keyed;
+  } else {
+    munmap(map, map_size);
+    return NULL;
+  }
+  if (header->hash_kind != (uint32_t) hash_policy_kind(&frozen_policy)) {
+    munmap(map, map_size);
+    return NULL;
+  }
+
+  struct frozen_table* frozen_table = malloc(sizeof(struct frozen_table));
+  assert(frozen_table);
+  frozen_table->map = map;
+  frozen_table->map_size = map_size;
+  frozen_table->entries = (const struct frozen_entry*) (header + 1);
+  frozen_table->bucket_start = (const uint32_t*) (frozen_table->entries + header->total);
+  frozen_table->keys = (const char*) (frozen_table->bucket_start + header->size + 1);
+  frozen_table->key_bytes = header->key_bytes;
+  if (!frozen_table_valid(frozen_table, header->size, header->total)) {
+    munmap(map, map_size);
+    free(frozen_table);
+    return NULL;
+  }
+
+  memset(&frozen_table->shape, 0, sizeof(frozen_table->shape));
+  hash_table_set_size(&frozen_table->shape, header->size, (header->flags & FROZEN_POW2) != 0);
+  frozen_table->shape.total = header->total;
+  frozen_table->shape.policy = frozen_policy;
+  frozen_table->shape.hash_kind = hash_policy_kind(&frozen_policy);
+  frozen_table->shape.seed[0] = header->seed[0];
+  frozen_table->shape.seed[1] = header->seed[1];
+  return frozen_table;
+}
+
+/*
+ * Unmaps the file and frees the handle.
+ */
+void frozen_table_close(struct frozen_table* frozen_table) {
+  assert(frozen_table);
+  munmap(frozen_table->map, frozen_table->map_size);
+  free(frozen_table);
+}
+
+/*
+ * Looks up key in its bucket's range of entries.  Offsets read from the file
+ * were checked by frozen_table_open(), so a damaged file cannot cause reads
+ * outside the map.
+ */
+int frozen_table_get(struct frozen_table* frozen_table, char* key, int* value) {
+  assert(frozen_table);
+
+  struct hash_table* shape = &frozen_table->shape;
+  uint64_t hash = hash_table_hash(shape, key);
+  size_t hash_index = hash_table_bucket(shape, hash);
+  assert(hash_index < shape->size);
+
+  uint32_t first = frozen_table->bucket_start[hash_index];
+  uint32_t last = frozen_table->bucket_start[hash_index + 1];
+
+  size_t key_len = strlen(key);
+  for (uint32_t i = first; i < last; i++) {
+    const struct frozen_entry* entry = &frozen_table->entries[i];
+    if (entry->hash != hash) {
+      continue;
+    }
+    const char* entry_key = frozen_table->keys + entry->key_offset;
+    int equal = shape->policy.equal == NULL
+        ? entry->key_len == key_len && memcmp(entry_key, key, key_len) == 0
+        : hash_table_equal(shape, entry_key, key);
+    if (equal) {
+      if (value != NULL) {
+        *value = entry->value;
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+size_t frozen_table_size(struct frozen_table* frozen_table) {
+  assert(frozen_table);
+  return frozen_table->shape.size;
+}
+
+size_t frozen_table_total(struct frozen_table* frozen_table) {
+  assert(frozen_table);
+  return frozen_table->shape.total;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file contains the definition of an interface for frozen hash tables:
+ * a read-only on-disk layout of a hash table that is memory-mapped and
+ * searched in place, with no deserialization step.  Any number of processes
+ * can map the same file and share its pages.
+ */
+
+#ifndef __FROZEN_TABLE_H
+#define __FROZEN_TABLE_H
+
+#include "hash_table.h"
+
+/*
+ * Structure used to represent an open, memory-mapped frozen table.
+ */
+struct frozen_table;
+
+/*
+ * Writes a hash table to a file in the frozen layout.  Buckets become ranges
+ * of a sorted entry array and all keys are packed into one blob, so the file
+ * can be queried directly once mapped.
+ *
+ * Params:
+ *   hash_table - the hash_table to freeze.  May not be NULL.  Only chained
+ *     tables holding int values can be frozen.
+ *   path - the file to create or overwrite
+ *
+ * Return:
+ *   returns 1 if the file was written, 0 otherwise
+ */
+int hash_table_freeze(struct hash_table* hash_table, const char* path);
+
+/*
+ * Maps a file written by hash_table_freeze() read-only into memory.
+ *
+ * Params:
+ *   path - the frozen table file
+ *   policy - the policy of the frozen table.  May be NULL if it hashed with
+ *     one of the built-in hash functions, in which case the matching
+ *     built-in policy is used.  Keyed tables keep their seed in the file.
+ *
+ * Return:
+ *   returns the frozen table, or NULL if the file could not be mapped, is
+ *   not a valid frozen table, or was frozen with a different hash function
+ */
+struct frozen_table* frozen_table_open(const char* path, const struct hash_policy* policy);
+
+/*
+ * Unmaps a frozen table and frees its handle.
+ *
+ * Params:
+ *   frozen_table - the table to close.  May not be NULL.
+ */
+void frozen_table_close(struct frozen_table* frozen_table);
+
+/*
+ * Looks up the value stored under a key, exactly like hash_table_get().
+ *
+ * Params:
+ *   frozen_table - the table to search.  May not be NULL.
+ *   key - the key to look for
+ *   value - receives the value if the key is found.  May be NULL.
+ *
+ * Return:
+ *   returns 1 if the key was found, 0 otherwise
+ */
+int frozen_table_get(struct frozen_table* frozen_table, char* key, int* value);
+
+/*
+ * Returns the number of buckets and the number of elements of a frozen table.
+ */
+size_t frozen_table_size(struct frozen_table* frozen_table);
+size_t frozen_table_total(struct frozen_table* frozen_table);
+
+#endif
@@ -0,0 +1,16 @@
+/*
+ * This file contains the definitions of functions for hashing many keys at
+ * once.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "hash_table_internal.h"
+#include "hash_batch.h"
+
+void hash_batch_function2(char** keys, size_t n, uint64_t* hashes) {
+  for (size_t i = 0; i < n; i++) {
+    hashes[i] = hash_raw_function2(keys[i]);
+  }
+}
@@ -0,0 +1,19 @@
+/*
+ * This file contains the definition of an interface for hashing many keys at
+ * once.  It is used by hash_table.c only; users of the hash table should
+ * only include hash_table.h.
+ */
+
+#ifndef __HASH_BATCH_H
+#define __HASH_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Stores the function2 hash (hash_raw_function2()) of each of the n keys at
+ * keys in hashes.
+ */
+void hash_batch_function2(char** keys, size_t n, uint64_t* hashes);
+
+#endif
@@ -3,91 +3,337 @@
  * a simple hash_table using a linked list.
  */
 
+#define _POSIX_C_SOURCE 200809L  // for write()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <math.h>    // for math functions
+#include <unistd.h>  // for write()
+#include <stdint.h>
+#include <errno.h>
 
 #include "node.h"
+#include "arena.h"
 #include "hash_table.h"
+#include "hash_table_internal.h"
+#include "cuckoo.h"
+#include "hopscotch.h"
+#include "chain_tree.h"
+#include "hash_batch.h"
+#include "bloom.h"
+#include "siphash.h"
 
-/*
- * Definition of the hash_table structure.
- * Uses an array of pointers to linked lists (buckets), the size of the table,
- * and a total count of inserted elements.
- */
-struct hash_table {
-  struct node** array;
-  int size;
-  int total;
-};
 
 /*
  * Returns: a hash code of an input string "key" using a naïve scheme.
  *
  * Note: This function only uses the first character of the key.
  */
-int hash_function1(struct hash_table* hash_table, char* key) {
-  return ((int) key[0]) % hash_table->size;
+size_t hash_function1(struct hash_table* hash_table, char* key) {
+  return hash_reduce_function1(hash_table, hash_raw_function1(key));
 }
 
 /*
  * Returns: a hash code of an input string "key" using an improved scheme.
  */
-int hash_function2(struct hash_table* hash_table, char* key) {
-  unsigned long hash_val = 0;
-  int c;
-  
-  // Convert the entire string to an integer using a multiplier of 31.
-  while ((c = *key++)) {
-    hash_val = hash_val * 31 + c;
+size_t hash_function2(struct hash_table* hash_table, char* key) {
+  return hash_reduce_function2(hash_table, hash_raw_function2(key));
+}
+
+/*
+ * Returns: a hash code of an input string "key" that depends on the table's
+ * secret seed.
+ */
+size_t hash_function_keyed(struct hash_table* hash_table, char* key) {
+  return hash_reduce_keyed(hash_table, hash_raw_keyed(hash_table, key));
+}
+
+const struct hash_policy hash_policy_function1 = { hash_function1, NULL, NULL, NULL, NULL };
+const struct hash_policy hash_policy_function2 = { hash_function2, NULL, NULL, NULL, NULL };
+const struct hash_policy hash_policy_keyed = { hash_function_keyed, NULL, NULL, NULL, NULL };
+
+char* hash_key_borrow(void* key_ctx, const char* key) {
+  (void) key_ctx;
+  return (char*) key;
+}
+
+void hash_policy_borrow(struct hash_policy* policy) {
+  assert(policy);
+  policy->copy_key = hash_key_borrow;
+  policy->free_key = NULL;
+  policy->key_ctx = NULL;
+}
+
+/*
+ * A keyed table reseeds once one of its chains is longer than
+ * HASH_TABLE_CHAIN_GUARD plus twice the load factor.
+ */
+#define HASH_TABLE_CHAIN_GUARD 16
+
+/*
+ * Returns the address of a node's inline value.
+ */
+static inline void* node_value(struct node* node) {
+  return node->value;
+}
+
+/*
+ * Returns a node's value the way hash_table_lookup() presents it.
+ */
+static void* node_public_value(struct hash_table* hash_table, struct node* node) {
+  return hash_table->pointer_values ? node->value[0].p : node_value(node);
+}
+
+/*
+ * Allocates a node holding a copy of key, from the arena if the table has one.
+ * Borrowed keys (hash_key_borrow()) are stored as they are.  The value is
+ * left for the caller to fill in.
+ */
+static struct node* node_create(struct hash_table* hash_table, char* key) {
+  struct node* new_node;
+  struct hash_policy* policy = &hash_table->policy;
+  if (hash_table->arena == NULL) {
+    new_node = malloc(hash_table->node_size);
+    assert(new_node);
+  } else {
+    new_node = hash_table->free_nodes;
+    if (new_node != NULL) {
+      hash_table->free_nodes = new_node->next;
+    } else {
+      new_node = arena_alloc(hash_table->arena, hash_table->node_size);
+    }
   }
-  
-  // Multiplicative hashing: multiply by A, take fractional part, then scale.
-  double A = 0.6180339887;
-  double product = (double) hash_val * A;
-  double frac = product - (unsigned long) product;  // fractional part extraction
-  int index = (int)(frac * hash_table->size);
-  
-  return index;
+  if (policy->copy_key == hash_key_borrow) {
+    new_node->key = key;
+  } else if (policy->copy_key != NULL) {
+    new_node->key = policy->copy_key(policy->key_ctx, key);
+    assert(new_node->key);
+  } else {
+    size_t key_size = strlen(key) + 1;
+    if (hash_table->arena == NULL) {
+      new_node->key = (char*) malloc(key_size * sizeof(char));
+      assert(new_node->key);
+    } else {
+      new_node->key = arena_alloc(hash_table->arena, key_size);
+    }
+    memcpy(new_node->key, key, key_size);
+  }
+  new_node->next = NULL;
+  return new_node;
+}
+
+/*
+ * Hands a node's value to the table's value_free callback, if it has one.
+ */
+static void node_free_value(struct hash_table* hash_table, struct node* node) {
+  if (hash_table->value_free == NULL) {
+    return;
+  }
+  if (hash_table->pointer_values) {
+    hash_table->value_free(node->value[0].p);
+  } else {
+    hash_table->value_free(node_value(node));
+  }
+}
+
+/*
+ * Releases a node that has been unlinked from its bucket.  Arena nodes are
+ * kept for reuse; their key storage is only reclaimed with the whole arena.
+ */
+void node_destroy(struct hash_table* hash_table, struct node* node) {
+  assert(node);
+  assert(node->key);
+  node_free_value(hash_table, node);
+  struct hash_policy* policy = &hash_table->policy;
+  if (policy->copy_key != NULL) {
+    if (policy->free_key != NULL) {
+      policy->free_key(policy->key_ctx, node->key);
+    }
+  } else if (hash_table->arena == NULL) {
+    free(node->key);
+  }
+  if (hash_table->arena == NULL) {
+    free(node);
+  } else {
+    node->next = hash_table->free_nodes;
+    hash_table->free_nodes = node;
+  }
+}
+
+/*
+ * Calls value_free and free_key on every element of an arena table, whose
+ * nodes are otherwise released without being visited.
+ */
+static void arena_free_values(struct hash_table* hash_table) {
+  struct hash_policy* policy = &hash_table->policy;
+  int free_keys = policy->copy_key != NULL && policy->free_key != NULL;
+  if (hash_table->value_free == NULL && !free_keys) {
+    return;
+  }
+  for (size_t i = 0; i < hash_table->size; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      node_free_value(hash_table, temp);
+      if (free_keys) {
+        policy->free_key(policy->key_ctx, temp->key);
+      }
+    }
+  }
+}
+
+/*
+ * Allocates a zeroed per-bucket array (the buckets or their generation tags)
+ * with the table's page options.  Either way large arrays are served with
+ * fresh pages that the kernel zero-fills on first touch, so a multi-GB array
+ * costs nothing up front and buckets that are never used take no memory.
+ */
+static void* buckets_alloc(struct hash_table* hash_table, size_t elem_size, size_t* mapped) {
+  assert(hash_table->size <= SIZE_MAX / elem_size);
+  void* array = page_alloc(hash_table->size * elem_size, &hash_table->pages, mapped);
+  assert(array);
+  return array;
+}
+
+/*
+ * Size of the arena chunks of a table: whole huge pages when the table asks
+ * for page placement, so every chunk can be backed by them.
+ */
+static size_t table_chunk_size(struct hash_table* hash_table) {
+  return page_options_set(&hash_table->pages) ? PAGE_HUGE_SIZE : 64 * 1024;
 }
 
 /*
  * Creates a new, empty hash_table with the specified array_size.
  */
-struct hash_table* hash_table_create(int array_size) {
+struct hash_table* hash_table_create(size_t array_size) {
+  struct hash_table_config config;
+  memset(&config, 0, sizeof(config));
+  config.array_size = array_size;
+  return hash_table_create_config(&config);
+}
+
+/*
+ * Creates a new, empty hash_table as described by config.
+ */
+struct hash_table* hash_table_create_config(const struct hash_table_config* config) {
+  assert(config);
+  assert(config->array_size > 0);
   struct hash_table* hash_table = malloc(sizeof(struct hash_table));
   assert(hash_table);
   hash_table->total = 0;
-  hash_table->size = array_size;
+  int cuckoo = config->backend == HASH_TABLE_CUCKOO;
+  int hopscotch = config->backend == HASH_TABLE_HOPSCOTCH;
+  hash_table_set_size(hash_table, config->array_size, config->pow2 || cuckoo || hopscotch);
+  hash_table->arena = NULL;
+  hash_table->free_nodes = NULL;
+
+  hash_table->pointer_values = config->pointer_values != 0;
+  hash_table->int_values = !hash_table->pointer_values && config->value_size == 0;
+  if (hash_table->pointer_values) {
+    hash_table->value_size = sizeof(void*);
+  } else if (hash_table->int_values) {
+    hash_table->value_size = sizeof(int);
+  } else {
+    hash_table->value_size = config->value_size;
+  }
+  hash_table->value_free = config->value_free;
+  hash_table->policy = config->policy != NULL ? *config->policy : hash_policy_function2;
+  assert(hash_table->policy.hash);
+  hash_table->hash_kind = hash_policy_kind(&hash_table->policy);
+  hash_table->seed[0] = 0;
+  hash_table->seed[1] = 0;
+  if (hash_table->hash_kind == HASH_KIND_KEYED) {
+    siphash_random_key(hash_table->seed);
+  }
+  hash_table->reseed_total = 0;
+  hash_table->bucket_gen = NULL;
+  hash_table->generation = 0;
+  hash_table->pages = config->pages;
+  hash_table->array = NULL;
+  hash_table->array_mapped = 0;
+  hash_table->gen_mapped = 0;
+  hash_table->cuckoo = NULL;
+  hash_table->hopscotch = NULL;
+  hash_table->filter = NULL;
+  hash_table->trees = NULL;
+  hash_table->trees_mapped = 0;
+  hash_table->tree_list = NULL;
+
+  // Round the value storage up to whole node_value elements to keep nodes aligned.
+  size_t slots = (hash_table->value_size + sizeof(union node_value) - 1) / sizeof(union node_value);
+  hash_table->node_size = sizeof(struct node) + slots * sizeof(union node_value);
   
-  // Allocate the array and initialize all buckets to NULL.
-  hash_table->array = malloc(array_size * sizeof(struct node*));
-  for (int i = 0; i < hash_table->size; i++) {
-    hash_table->array[i] = NULL;
+  // Allocate the array with all buckets NULL, or the backend's own slots.
+  if (cuckoo) {
+    hash_table->cuckoo = cuckoo_create(hash_table);
+  } else if (hopscotch) {
+    hash_table->hopscotch = hopscotch_create(hash_table);
+  } else {
+    hash_table->array = buckets_alloc(hash_table, sizeof(struct node*), &hash_table->array_mapped);
+  }
+
+  if (config->fast_reset || page_options_set(&config->pages)) {
+    hash_table->arena = malloc(sizeof(struct arena));
+    assert(hash_table->arena);
+    arena_init_pages(hash_table->arena, table_chunk_size(hash_table), &hash_table->pages);
+  }
+  if (config->fast_reset && hash_table->array != NULL) {
+    hash_table->bucket_gen = buckets_alloc(hash_table, sizeof(unsigned int), &hash_table->gen_mapped);
+  }
+  if (config->filter_capacity > 0) {
+    hash_table->filter = bloom_create(config->filter_capacity, &hash_table->pages);
   }
   
   return hash_table;
 }
 
+/*
+ * Replaces the policy of an empty hash_table.
+ */
+void hash_table_set_policy(struct hash_table* hash_table, const struct hash_policy* policy) {
+  assert(hash_table);
+  assert(policy && policy->hash);
+  assert(hash_table->total == 0);
+  hash_table->policy = *policy;
+  hash_table->hash_kind = hash_policy_kind(policy);
+  hash_table->reseed_total = 0;
+  if (hash_table->hash_kind == HASH_KIND_KEYED) {
+    siphash_random_key(hash_table->seed);
+  }
+}
+
 /*
  * Frees all the memory associated with the hash_table.
  */
 void hash_table_free(struct hash_table* hash_table) {
   assert(hash_table);
-  for (int i = 0; i < hash_table->size; i++) {
-    struct node* current = hash_table->array[i];
-    while (current != NULL) {
-      hash_table->array[i] = current->next;
-      assert(current->key);
-      free(current->key);
-      assert(current);
-      free(current);
-      current = hash_table->array[i];
+  chain_tree_free_all(hash_table);
+  if (hash_table->cuckoo != NULL) {
+    cuckoo_free(hash_table);
+  } else if (hash_table->hopscotch != NULL) {
+    hopscotch_free(hash_table);
+  } else if (hash_table->arena != NULL) {
+    // Every node and key lives in the arena, so only values need visiting.
+    arena_free_values(hash_table);
+  } else {
+    for (size_t i = 0; i < hash_table->size; i++) {
+      struct node* current = hash_table->array[i];
+      while (current != NULL) {
+        hash_table->array[i] = current->next;
+        node_destroy(hash_table, current);
+        current = hash_table->array[i];
+      }
     }
   }
-  free(hash_table->array);
+  if (hash_table->arena != NULL) {
+    arena_release(hash_table->arena);
+    free(hash_table->arena);
+  }
+  bloom_free(hash_table->filter);
+  page_free(hash_table->trees, hash_table->trees_mapped);
+  page_free(hash_table->bucket_gen, hash_table->gen_mapped);
+  page_free(hash_table->array, hash_table->array_mapped);
   free(hash_table);
 }
 
@@ -96,14 +342,47 @@ void hash_table_free(struct hash_table* hash_table) {
  */
 void hash_table_reset(struct hash_table* hash_table) {
   assert(hash_table);
-  for (int i = 0; i < hash_table->size; i++) {
+  chain_tree_free_all(hash_table);
+  hash_table->reseed_total = 0;
+  if (hash_table->filter != NULL) {
+    bloom_clear(hash_table->filter);
+  }
+  if (hash_table->cuckoo != NULL || hash_table->hopscotch != NULL) {
+    if (hash_table->cuckoo != NULL) {
+      cuckoo_clear(hash_table);
+    } else {
+      hopscotch_clear(hash_table);
+    }
+    if (hash_table->arena != NULL) {
+      arena_reset(hash_table->arena);
+      hash_table->free_nodes = NULL;
+    }
+    hash_table->total = 0;
+    return;
+  }
+  if (hash_table->arena != NULL) {
+    // Drop every chain and hand all node and key storage back at once.  With
+    // generation tags, moving to the next generation empties every bucket;
+    // only when the counter wraps do the buckets need clearing for real.
+    arena_free_values(hash_table);
+    if (hash_table->bucket_gen == NULL || ++hash_table->generation == 0) {
+      for (size_t i = 0; i < hash_table->size; i++) {
+        hash_table->array[i] = NULL;
+      }
+      if (hash_table->bucket_gen != NULL) {
+        memset(hash_table->bucket_gen, 0, hash_table->size * sizeof(unsigned int));
+      }
+    }
+    arena_reset(hash_table->arena);
+    hash_table->free_nodes = NULL;
+    hash_table->total = 0;
+    return;
+  }
+  for (size_t i = 0; i < hash_table->size; i++) {
     struct node* current = hash_table->array[i];
     while (current != NULL) {
       hash_table->array[i] = current->next;
-      assert(current->key);
-      free(current->key);
-      assert(current);
-      free(current);
+      node_destroy(hash_table, current);
       current = hash_table->array[i];
       // Decrease the total for each removed node.
       hash_table->total--;
@@ -112,25 +391,196 @@ void hash_table_reset(struct hash_table* hash_table) {
 }
 
 /*
- * Adds a new (key, value) pair to the hash_table using the provided hash function.
+ * Returns the hash a node holding key caches: hash_table_hash() in chained
+ * tables, the cuckoo or hopscotch hash otherwise.
+ */
+static uint64_t hash_table_key_hash(struct hash_table* hash_table, char* key) {
+  if (hash_table->cuckoo != NULL) {
+    return cuckoo_hash(hash_table, key);
+  }
+  if (hash_table->hopscotch != NULL) {
+    return hopscotch_hash(hash_table, key);
+  }
+  return hash_table_hash(hash_table, key);
+}
+
+/*
+ * Refills the filter of a cuckoo or hopscotch table that has grown.  Custom
+ * hashes are bucket indices, so growing changes the filter hash of every
+ * key; the built-in ones do not depend on the size.
+ */
+static void filter_resized(struct hash_table* hash_table, size_t old_size) {
+  if (hash_table->filter == NULL || hash_table->size == old_size
+      || hash_table->hash_kind != HASH_KIND_CUSTOM) {
+    return;
+  }
+  bloom_clear(hash_table->filter);
+  struct hash_table_iter iter;
+  const char* key;
+  hash_table_iter_begin(hash_table, &iter);
+  while (hash_table_iter_next(&iter, &key, NULL)) {
+    bloom_add(hash_table->filter, hash_table_filter_hash(hash_table, iter.node->hash, key));
+  }
+}
+
+/*
+ * Takes one occurrence of a filter hash out of the table's filter, if any.
  */
-void hash_table_add(struct hash_table* hash_table, int (*hf)(struct hash_table*, char*), char* key, int value) {
+static void filter_forget(struct hash_table* hash_table, uint64_t filter_hash) {
+  if (hash_table->filter != NULL) {
+    bloom_remove(hash_table->filter, filter_hash);
+  }
+}
+
+/*
+ * Gives a keyed chained table a new seed and moves every element to its
+ * bucket under it.
+ */
+static void hash_table_reseed(struct hash_table* hash_table) {
+  siphash_random_key(hash_table->seed);
+  chain_tree_free_all(hash_table);
+
+  // Unlink everything into one list, then push each node onto its new chain.
+  // Both steps reverse the order, so elements sharing a chain keep theirs.
+  struct node* all = NULL;
+  for (size_t i = 0; i < hash_table->size; i++) {
+    struct node** head = bucket_link(hash_table, i);
+    while (*head != NULL) {
+      struct node* node = *head;
+      *head = node->next;
+      node->next = all;
+      all = node;
+    }
+  }
+  if (hash_table->filter != NULL) {
+    bloom_clear(hash_table->filter);
+  }
+  while (all != NULL) {
+    struct node* node = all;
+    all = node->next;
+    node->hash = hash_table_hash(hash_table, node->key);
+    if (hash_table->filter != NULL) {
+      bloom_add(hash_table->filter, hash_table_filter_hash(hash_table, node->hash, node->key));
+    }
+    struct node** head = bucket_link(hash_table, hash_table_bucket(hash_table, node->hash));
+    node->next = *head;
+    *head = node;
+  }
+  hash_table->reseed_total = hash_table->total;
+  chain_tree_scan(hash_table);
+}
+
+/*
+ * Reseeds a keyed table whose chain starting at head has grown too long.
+ * Under a secret seed that only happens by rare chance or because someone
+ * has found colliding keys.  Reseeds are spaced out by doubling element
+ * counts, so keys that collide under every seed (the same key added over and
+ * over) cannot make insertions expensive.  Returns 1 if it reseeded.
+ */
+static int chain_guard(struct hash_table* hash_table, struct node* head) {
+  size_t limit = HASH_TABLE_CHAIN_GUARD + 2 * (hash_table->total / hash_table->size);
+  size_t length = 0;
+  for (; head != NULL && length <= limit; head = head->next) {
+    length++;
+  }
+  if (length > limit && hash_table->total >= 2 * hash_table->reseed_total) {
+    hash_table_reseed(hash_table);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Runs chain_guard() over every chain of a keyed table, stopping at the
+ * first reseed.
+ */
+void hash_table_guard_chains(struct hash_table* hash_table) {
   assert(hash_table);
-  struct node* new_node = malloc(sizeof(struct node));
-  assert(new_node);
-  
-  new_node->key = (char*) malloc((strlen(key) + 1) * sizeof(char));
-  strcpy(new_node->key, key);
-  new_node->value = value;
-  new_node->next = NULL;
-  
-  int hash_index = (*hf)(hash_table, key);
+  if (hash_table->hash_kind != HASH_KIND_KEYED) {
+    return;
+  }
+  for (size_t i = 0; i < hash_table->size; i++) {
+    if (chain_guard(hash_table, bucket_head(hash_table, i))) {
+      return;
+    }
+  }
+}
+
+/*
+ * Links a new node holding key, whose hash is hash, into its chain and
+ * returns it.
+ */
+static struct node* chain_insert(struct hash_table* hash_table, char* key, uint64_t hash) {
+  struct node* new_node = node_create(hash_table, key);
+  new_node->hash = hash;
+  if (hash_table->filter != NULL) {
+    bloom_add(hash_table->filter, hash_table_filter_hash(hash_table, new_node->hash, key));
+  }
+  size_t hash_index = hash_table_bucket(hash_table, new_node->hash);
   
   // Insert new node at the beginning of the list at the computed bucket.
-  new_node->next = hash_table->array[hash_index];
-  hash_table->array[hash_index] = new_node;
+  struct node** head = bucket_link(hash_table, hash_index);
+  new_node->next = *head;
+  *head = new_node;
   
   hash_table->total++;
+  if (chain_tree_enabled(hash_table)) {
+    chain_tree_inserted(hash_table, hash_index, new_node);
+  }
+  if (hash_table->hash_kind == HASH_KIND_KEYED) {
+    chain_guard(hash_table, new_node);
+  }
+  return new_node;
+}
+
+/*
+ * Links a new node holding key into its bucket and returns it; the caller
+ * fills in the value.
+ */
+static struct node* hash_table_insert(struct hash_table* hash_table, char* key) {
+  assert(hash_table);
+  if (hash_table->array != NULL) {
+    return chain_insert(hash_table, key, hash_table_hash(hash_table, key));
+  }
+
+  struct node* new_node = node_create(hash_table, key);
+  size_t old_size = hash_table->size;
+  new_node->hash = hash_table_key_hash(hash_table, key);
+  if (hash_table->filter != NULL) {
+    bloom_add(hash_table->filter, hash_table_filter_hash(hash_table, new_node->hash, key));
+  }
+  if (hash_table->cuckoo != NULL) {
+    cuckoo_insert(hash_table, new_node);
+  } else {
+    hopscotch_insert(hash_table, new_node);
+  }
+  hash_table->total++;
+  filter_resized(hash_table, old_size);
+  return new_node;
+}
+
+/*
+ * Adds a new (key, value) pair to the hash_table.
+ */
+void hash_table_add(struct hash_table* hash_table, char* key, int value) {
+  assert(hash_table);
+  assert(hash_table->int_values);
+  struct node* new_node = hash_table_insert(hash_table, key);
+  new_node->value[0].i = value;
+}
+
+/*
+ * Adds a new (key, value) pair of the table's value type.
+ */
+void hash_table_add_value(struct hash_table* hash_table, char* key, const void* value) {
+  assert(hash_table);
+  struct node* new_node = hash_table_insert(hash_table, key);
+  if (hash_table->pointer_values) {
+    new_node->value[0].p = (void*) value;
+  } else {
+    assert(value);
+    memcpy(node_value(new_node), value, hash_table->value_size);
+  }
 }
 
 /*
@@ -138,27 +588,72 @@ void hash_table_add(struct hash_table* hash_table, int (*hf)(struct hash_table*,
  *
  * Returns 1 if the removal was successful, 0 if the key was not found.
  */
-int hash_table_remove(struct hash_table* hash_table, int (*hf)(struct hash_table*, char*), char* key) {
+int hash_table_remove(struct hash_table* hash_table, char* key) {
   assert(hash_table);
+
+  // The key is hashed once, for the filter and the buckets alike.  A key the
+  // filter rules out is in no bucket.
+  uint64_t hash = hash_table_key_hash(hash_table, key);
+  uint64_t filter_hash = 0;
+  if (hash_table->filter != NULL) {
+    filter_hash = hash_table_filter_hash(hash_table, hash, key);
+    if (!bloom_maybe(hash_table->filter, filter_hash)) {
+      printf("The key %s not found in hash table.\n", key);
+      return 0;
+    }
+  }
+
+  if (hash_table->array == NULL) {
+    struct node* node = hash_table->cuckoo != NULL ? cuckoo_unlink(hash_table, key, hash)
+                                                   : hopscotch_unlink(hash_table, key, hash);
+    if (node == NULL) {
+      printf("The key %s not found in hash table.\n", key);
+      return 0;
+    }
+    printf("removing %s from hash table, should match %s\n", node->key, key);
+    node_destroy(hash_table, node);
+    hash_table->total--;
+    filter_forget(hash_table, filter_hash);
+    return 1;
+  }
   assert(hash_table->array);
   
-  int hash_index = (*hf)(hash_table, key);
+  size_t hash_index = hash_table_bucket(hash_table, hash);
+
+  // A treeified bucket finds the node without walking its chain.
+  if (bucket_tree(hash_table, hash_index) != NULL) {
+    int head;
+    struct node* node = chain_tree_unlink(hash_table, hash_index, hash, key, &head);
+    if (node == NULL) {
+      printf("The key %s not found in hash table.\n", key);
+      return 0;
+    }
+    if (head) {
+      printf("removing %s from hash table, should match %s\n", node->key, key);
+    } else {
+      printf("trying to free: %s\n", node->key);
+    }
+    node_destroy(hash_table, node);
+    hash_table->total--;
+    filter_forget(hash_table, filter_hash);
+    return 1;
+  }
   
   // First, check if the key is at the start of the bucket.
-  struct node* temp = hash_table->array[hash_index];
-  if (temp != NULL && strcmp(temp->key, key) == 0) {
+  struct node** head = bucket_link(hash_table, hash_index);
+  struct node* temp = *head;
+  if (temp != NULL && hash_table_match(hash_table, temp, hash, key)) {
     printf("removing %s from hash table, should match %s\n", temp->key, key);
-    hash_table->array[hash_index] = temp->next;
-    assert(temp->key);
-    free(temp->key);
-    free(temp);
+    *head = temp->next;
+    node_destroy(hash_table, temp);
     hash_table->total--;
+    filter_forget(hash_table, filter_hash);
     return 1;
   }
   
   // Otherwise, search through the list.
   struct node* prev;
-  while (temp != NULL && strcmp(temp->key, key) != 0) {
+  while (temp != NULL && !hash_table_match(hash_table, temp, hash, key)) {
     prev = temp;
     temp = temp->next;
   }
@@ -172,25 +667,288 @@ int hash_table_remove(struct hash_table* hash_table, int (*hf)(struct hash_table
   // Remove the node with the matching key.
   prev->next = temp->next;
   printf("trying to free: %s\n", temp->key);
-  assert(temp->key);
-  free(temp->key);
-  free(temp);
+  node_destroy(hash_table, temp);
+  hash_table->total--;
+  filter_forget(hash_table, filter_hash);
   
   return 1;
 }
 
+/*
+ * Finds the node holding key, whose hash is hash, in a chained table.
+ */
+static struct node* chain_find(struct hash_table* hash_table, char* key, uint64_t hash) {
+  assert(hash_table->array);
+  if (hash_table->filter != NULL
+      && !bloom_maybe(hash_table->filter, hash_table_filter_hash(hash_table, hash, key))) {
+    return NULL;
+  }
+  size_t hash_index = hash_table_bucket(hash_table, hash);
+  struct chain_tree* tree = bucket_tree(hash_table, hash_index);
+  if (tree != NULL) {
+    return chain_tree_find(tree, hash, key);
+  }
+  for (struct node* temp = bucket_head(hash_table, hash_index); temp != NULL; temp = temp->next) {
+    if (hash_table_match(hash_table, temp, hash, key)) {
+      return temp;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Finds the node holding key, or returns NULL.
+ */
+static struct node* hash_table_find(struct hash_table* hash_table, char* key) {
+  assert(hash_table);
+  uint64_t hash = hash_table_key_hash(hash_table, key);
+  if (hash_table->array != NULL) {
+    return chain_find(hash_table, key, hash);
+  }
+  if (hash_table->filter != NULL
+      && !bloom_maybe(hash_table->filter, hash_table_filter_hash(hash_table, hash, key))) {
+    return NULL;
+  }
+  if (hash_table->cuckoo != NULL) {
+    return cuckoo_find(hash_table, key, hash);
+  }
+  return hopscotch_find(hash_table, key, hash);
+}
+
+/*
+ * Looks up the value stored under key.
+ *
+ * Returns 1 and stores the value in *value if the key was found, 0 otherwise.
+ */
+int hash_table_get(struct hash_table* hash_table, char* key, int* value) {
+  assert(hash_table);
+  assert(hash_table->int_values);
+  struct node* node = hash_table_find(hash_table, key);
+  if (node == NULL) {
+    return 0;
+  }
+  if (value != NULL) {
+    *value = node->value[0].i;
+  }
+  return 1;
+}
+
+/*
+ * Looks up the value stored under key in a table of any value type.
+ */
+void* hash_table_lookup(struct hash_table* hash_table, char* key) {
+  struct node* node = hash_table_find(hash_table, key);
+  if (node == NULL) {
+    return NULL;
+  }
+  return node_public_value(hash_table, node);
+}
+
+/*
+ * Number of keys the batch functions hash in one go.
+ */
+#define HASH_BATCH_SIZE 64
+
+void hash_table_hash_batch(struct hash_table* hash_table, char** keys, size_t n, uint64_t* hashes) {
+  if (hash_table->hash_kind == HASH_KIND_FUNCTION2) {
+    hash_batch_function2(keys, n, hashes);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    hashes[i] = hash_table_hash(hash_table, keys[i]);
+  }
+}
+
+/*
+ * Adds n keys with their values, hashing them in batches.
+ */
+void hash_table_add_batch(struct hash_table* hash_table, char** keys, const void* values, size_t n) {
+  assert(hash_table);
+  assert(n == 0 || (keys && values));
+  const char* value = values;
+
+  // A keyed table may reseed while adding, which would make hashes taken
+  // ahead of time stale, so it is fed one key at a time.
+  int batched = hash_table->array != NULL && hash_table->hash_kind != HASH_KIND_KEYED;
+  uint64_t hashes[HASH_BATCH_SIZE];
+  for (size_t first = 0; first < n; first += HASH_BATCH_SIZE) {
+    size_t count = n - first < HASH_BATCH_SIZE ? n - first : HASH_BATCH_SIZE;
+    if (batched) {
+      hash_table_hash_batch(hash_table, keys + first, count, hashes);
+    }
+    for (size_t i = 0; i < count; i++) {
+      char* key = keys[first + i];
+      struct node* node = batched ? chain_insert(hash_table, key, hashes[i])
+                                  : hash_table_insert(hash_table, key);
+      memcpy(node_value(node), value, hash_table->value_size);
+      value += hash_table->value_size;
+    }
+  }
+}
+
+/*
+ * Looks up n keys, hashing them in batches.
+ */
+size_t hash_table_lookup_batch(struct hash_table* hash_table, char** keys, size_t n, void** values) {
+  assert(hash_table);
+  assert(n == 0 || (keys && values));
+  size_t found = 0;
+  uint64_t hashes[HASH_BATCH_SIZE];
+  for (size_t first = 0; first < n; first += HASH_BATCH_SIZE) {
+    size_t count = n - first < HASH_BATCH_SIZE ? n - first : HASH_BATCH_SIZE;
+    if (hash_table->array != NULL) {
+      hash_table_hash_batch(hash_table, keys + first, count, hashes);
+    }
+    for (size_t i = 0; i < count; i++) {
+      char* key = keys[first + i];
+      struct node* node = hash_table->array != NULL ? chain_find(hash_table, key, hashes[i])
+                                                    : hash_table_find(hash_table, key);
+      values[first + i] = node != NULL ? node_public_value(hash_table, node) : NULL;
+      found += node != NULL;
+    }
+  }
+  return found;
+}
+
+/*
+ * Positions an iterator before the first element.
+ */
+void hash_table_iter_begin(struct hash_table* hash_table, struct hash_table_iter* iter) {
+  assert(hash_table);
+  assert(iter);
+  iter->hash_table = hash_table;
+  iter->bucket = 0;
+  iter->link = NULL;
+  iter->node = NULL;
+}
+
+/*
+ * Advances a chained table's iterator to the next node.  "link" is the
+ * pointer that refers to the current node (a bucket head or the previous
+ * node's next field), which is what makes removing the current node O(1).
+ * It is NULL until the first bucket has been looked at.
+ *
+ * Buckets are read with bucket_head(), so iterating writes nothing to the
+ * table.  A bucket that has a head is of the current generation, so its
+ * head pointer can serve as the link as it is.
+ */
+static int chain_iter_next(struct hash_table_iter* iter) {
+  struct hash_table* hash_table = iter->hash_table;
+  if (iter->bucket >= hash_table->size) {
+    return 0;
+  }
+  if (iter->node != NULL) {
+    iter->link = &iter->node->next;
+  }
+  if (iter->link == NULL || *iter->link == NULL) {
+    size_t i = iter->link == NULL ? iter->bucket : iter->bucket + 1;
+    while (i < hash_table->size && bucket_head(hash_table, i) == NULL) {
+      i++;
+    }
+    iter->bucket = i;
+    if (i >= hash_table->size) {
+      iter->node = NULL;
+      return 0;
+    }
+    iter->link = &hash_table->array[i];
+  }
+  iter->node = *iter->link;
+  return 1;
+}
+
+/*
+ * Advances to the next element.
+ */
+int hash_table_iter_next(struct hash_table_iter* iter, const char** key, void** value) {
+  assert(iter);
+  struct hash_table* hash_table = iter->hash_table;
+  int found;
+  if (hash_table->cuckoo != NULL) {
+    found = cuckoo_iter_next(iter);
+  } else if (hash_table->hopscotch != NULL) {
+    found = hopscotch_iter_next(iter);
+  } else {
+    found = chain_iter_next(iter);
+  }
+  if (!found) {
+    return 0;
+  }
+  if (key != NULL) {
+    *key = iter->node->key;
+  }
+  if (value != NULL) {
+    *value = node_public_value(hash_table, iter->node);
+  }
+  return 1;
+}
+
+/*
+ * Unlinks and frees the current element.  Clearing iter->node keeps "link"
+ * in place, so the next step lands on the element that followed.
+ */
+void hash_table_iter_remove(struct hash_table_iter* iter) {
+  assert(iter);
+  assert(iter->node);
+  if (iter->hash_table->filter != NULL) {
+    bloom_remove(iter->hash_table->filter,
+                 hash_table_filter_hash(iter->hash_table, iter->node->hash, iter->node->key));
+  }
+  if (iter->hash_table->cuckoo != NULL) {
+    cuckoo_iter_unlink(iter);
+  } else if (iter->hash_table->hopscotch != NULL) {
+    hopscotch_iter_unlink(iter);
+  } else if (bucket_tree(iter->hash_table, iter->bucket) != NULL) {
+    chain_tree_unlink_node(iter->hash_table, iter->bucket, iter->node);
+  } else {
+    *iter->link = iter->node->next;
+  }
+  node_destroy(iter->hash_table, iter->node);
+  iter->hash_table->total--;
+  iter->node = NULL;
+}
+
+/*
+ * Calls visit on every element, removing those it asks to have removed.
+ */
+size_t hash_table_foreach(struct hash_table* hash_table,
+                          enum hash_table_visit (*visit)(const char* key, void* value, void* ctx),
+                          void* ctx) {
+  assert(visit);
+  struct hash_table_iter iter;
+  const char* key;
+  void* value;
+  size_t visited = 0;
+  hash_table_iter_begin(hash_table, &iter);
+  while (hash_table_iter_next(&iter, &key, &value)) {
+    visited++;
+    enum hash_table_visit action = visit(key, value, ctx);
+    if (action == HASH_TABLE_VISIT_REMOVE) {
+      hash_table_iter_remove(&iter);
+    } else if (action == HASH_TABLE_VISIT_STOP) {
+      break;
+    }
+  }
+  return visited;
+}
+
 /*
  * Counts the total number of collisions in the hash_table.
  *
  * For each bucket:
  *   If the bucket contains n nodes, then (n - 1) collisions occurred.
  */
-int hash_table_collisions(struct hash_table* hash_table) {
-  int num_col = 0;
+size_t hash_table_collisions(struct hash_table* hash_table) {
+  size_t num_col = 0;
+  if (hash_table->cuckoo != NULL) {
+    return cuckoo_displaced(hash_table);
+  }
+  if (hash_table->hopscotch != NULL) {
+    return hopscotch_displaced(hash_table);
+  }
   
-  for (int i = 0; i < hash_table->size; i++) {
-    int count = 0;
-    struct node* current = hash_table->array[i];
+  for (size_t i = 0; i < hash_table->size; i++) {
+    size_t count = 0;
+    struct node* current = bucket_head(hash_table, i);
     while (current != NULL) {
       count++;
       current = current->next;
@@ -204,22 +962,645 @@ int hash_table_collisions(struct hash_table* hash_table) {
 }
 
 /*
- * Displays the content of the hash_table.
+ * Reads the counters of a cuckoo table.
  */
-void display(struct hash_table* hash_table) {
-  printf("Hash table, size=%d, total=%d\n", hash_table->size, hash_table->total);
-  for (int i = 0; i < hash_table->size; i++) {
-    struct node* temp = hash_table->array[i];
-    if (temp == NULL) {
-      printf("array[%d]-|\n", i);
+int hash_table_cuckoo_stats(struct hash_table* hash_table, struct hash_table_cuckoo_stats* stats) {
+  assert(hash_table);
+  assert(stats);
+  if (hash_table->cuckoo == NULL) {
+    return 0;
+  }
+  *stats = hash_table->cuckoo->stats;
+  stats->buckets = hash_table->size;
+  stats->stash_used = hash_table->cuckoo->stash_used;
+  return 1;
+}
+
+/*
+ * Snapshot file layout (native byte order):
+ *
+ *   struct snapshot_header
+ *   records[total]   - in bucket order, each chain head first; every record
+ *                      is a struct snapshot_record followed by value_size
+ *                      bytes of value.  The bucket of a record follows from
+ *                      its hash.
+ *   key blob         - every key, NUL-terminated, in the same order as the
+ *                      records
+ */
+#define SNAPSHOT_MAGIC "HTSNAP5"
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_INT_VALUES 0x1u
+#define SNAPSHOT_POW2 0x2u
+
+struct snapshot_header {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t value_size;
+  uint32_t flags;
+  uint32_t hash_kind;
+  uint64_t size;
+  uint64_t total;
+  uint64_t key_bytes;
+  uint64_t seed[2];
+};
+
+struct snapshot_record {
+  uint64_t hash;
+  uint32_t key_len;
+  uint32_t reserved;
+};
+
+/*
+ * Largest value_size a snapshot may have.  Loading checks it before sizing
+ * any buffer after it.
+ */
+#define SNAPSHOT_MAX_VALUE_SIZE (64 * 1024)
+
+/*
+ * Records are moved to or from the file SNAPSHOT_BATCH per stdio call, or
+ * fewer when values are so large that a batch would exceed
+ * SNAPSHOT_BATCH_BYTES.
+ */
+#define SNAPSHOT_BATCH 4096
+#define SNAPSHOT_BATCH_BYTES (1024 * 1024)
+
+static size_t snapshot_batch(size_t stride) {
+  size_t count = SNAPSHOT_BATCH_BYTES / stride;
+  return count == 0 ? 1 : count < SNAPSHOT_BATCH ? count : SNAPSHOT_BATCH;
+}
+
+/*
+ * Writes the hash_table to a binary snapshot file.
+ */
+int hash_table_save(struct hash_table* hash_table, const char* path) {
+  assert(hash_table);
+  assert(path);
+
+  // Payload pointers mean nothing outside this process, and the format
+  // describes chains only.
+  if (hash_table->pointer_values || hash_table->array == NULL
+      || hash_table->value_size > SNAPSHOT_MAX_VALUE_SIZE) {
+    return 0;
+  }
+
+  FILE* out = fopen(path, "wb");
+  if (out == NULL) {
+    return 0;
+  }
+
+  struct snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.size = hash_table->size;
+  header.total = hash_table->total;
+  header.value_size = (uint32_t) hash_table->value_size;
+  header.flags = hash_table->int_values ? SNAPSHOT_INT_VALUES : 0;
+  if (hash_table->pow2) {
+    header.flags |= SNAPSHOT_POW2;
+  }
+  header.hash_kind = (uint32_t) hash_table->hash_kind;
+  header.seed[0] = hash_table->seed[0];
+  header.seed[1] = hash_table->seed[1];
+  for (size_t i = 0; i < hash_table->size; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      header.key_bytes += strlen(temp->key) + 1;
+    }
+  }
+  int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+  // Records, batched so that each fwrite moves many entries.
+  size_t stride = sizeof(struct snapshot_record) + hash_table->value_size;
+  size_t batch_count = snapshot_batch(stride);
+  char* batch = malloc(batch_count * stride);
+  assert(batch);
+  size_t count = 0;
+  for (size_t i = 0; i < hash_table->size && ok; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      struct snapshot_record record;
+      memset(&record, 0, sizeof(record));
+      record.hash = temp->hash;
+      record.key_len = (uint32_t) strlen(temp->key);
+      memcpy(batch + count * stride, &record, sizeof(record));
+      memcpy(batch + count * stride + sizeof(record), node_value(temp), hash_table->value_size);
+      if (++count == batch_count) {
+        ok = ok && fwrite(batch, stride, count, out) == count;
+        count = 0;
+      }
+    }
+  }
+  if (count > 0) {
+    ok = ok && fwrite(batch, stride, count, out) == count;
+  }
+  free(batch);
+
+  // Key blob, in the same order as the records.
+  for (size_t i = 0; i < hash_table->size && ok; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      size_t len = strlen(temp->key) + 1;
+      if (fwrite(temp->key, 1, len, out) != len) {
+        ok = 0;
+        break;
+      }
+    }
+  }
+
+  if (fclose(out) != 0) {
+    ok = 0;
+  }
+  return ok;
+}
+
+/*
+ * Loads a hash_table from a snapshot written by hash_table_save().
+ *
+ * All nodes and the key blob are placed in one arena allocation, the key blob
+ * is read straight into place, and chains are rebuilt from the recorded
+ * hashes, so no key is hashed or individually allocated.  Since the
+ * keys live in that blob, the loaded table always owns its keys and ignores
+ * the policy's copy_key and free_key.
+ */
+struct hash_table* hash_table_load(const char* path, const struct hash_policy* policy) {
+  assert(path);
+
+  FILE* in = fopen(path, "rb");
+  if (in == NULL) {
+    return NULL;
+  }
+
+  struct snapshot_header header;
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+      || header.byte_order != SNAPSHOT_BYTE_ORDER
+      || header.size == 0 || header.size > SIZE_MAX / sizeof(struct node*)
+      || header.total > SIZE_MAX / 2
+      || header.key_bytes < header.total
+      || header.value_size > SNAPSHOT_MAX_VALUE_SIZE
+      || ((header.flags & SNAPSHOT_INT_VALUES) && header.value_size != sizeof(int))
+      || ((header.flags & SNAPSHOT_POW2) && (header.size < 2 || (header.size & (header.size - 1)) != 0))) {
+    fclose(in);
+    return NULL;
+  }
+
+  // The records and the key blob must fill the rest of the file exactly,
+  // which bounds everything allocated for them below.
+  size_t stride = sizeof(struct snapshot_record) + header.value_size;
+  off_t file_end = fseeko(in, 0, SEEK_END) == 0 ? ftello(in) : -1;
+  if (file_end < (off_t) sizeof(header)) {
+    fclose(in);
+    return NULL;
+  }
+  uint64_t payload = (uint64_t) file_end - sizeof(header);
+  if (header.total > payload / stride || header.key_bytes != payload - header.total * stride) {
+    fclose(in);
+    return NULL;
+  }
+
+  // The table must hash exactly as the saved one did.
+  struct hash_policy loaded_policy;
+  if (policy != NULL) {
+    loaded_policy = *policy;
+  } else if (header.hash_kind == HASH_KIND_FUNCTION1) {
+    loaded_policy = hash_policy_function1;
+  } else if (header.hash_kind == HASH_KIND_FUNCTION2) {
+    loaded_policy = hash_policy_function2;
+  } else if (header.hash_kind == HASH_KIND_KEYED) {
+    loaded_policy = hash_policy_keyed;
+  } else {
+    fclose(in);
+    return NULL;
+  }
+  if (header.hash_kind != (uint32_t) hash_policy_kind(&loaded_policy)) {
+    fclose(in);
+    return NULL;
+  }
+  loaded_policy.copy_key = NULL;
+  loaded_policy.free_key = NULL;
+
+  struct hash_table_config config;
+  memset(&config, 0, sizeof(config));
+  config.array_size = (size_t) header.size;
+  config.policy = &loaded_policy;
+  config.value_size = (header.flags & SNAPSHOT_INT_VALUES) ? 0 : header.value_size;
+  config.pow2 = (header.flags & SNAPSHOT_POW2) != 0;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  hash_table->seed[0] = header.seed[0];
+  hash_table->seed[1] = header.seed[1];
+  if (header.total > (SIZE_MAX - header.key_bytes) / hash_table->node_size) {
+    fclose(in);
+    hash_table_free(hash_table);
+    return NULL;
+  }
+  hash_table->arena = malloc(sizeof(struct arena));
+  assert(hash_table->arena);
+  arena_init(hash_table->arena, 64 * 1024);
+
+  size_t node_bytes = header.total * hash_table->node_size;
+  char* nodes = arena_alloc(hash_table->arena, node_bytes + header.key_bytes);
+  char* keys = nodes + node_bytes;
+  char* keys_end = keys + header.key_bytes;
+
+  // The key blob follows the records; read it first, straight into place.
+  off_t records_end = (off_t) sizeof(header) + (off_t) header.total * (off_t) stride;
+  int ok = fseeko(in, records_end, SEEK_SET) == 0
+      && fread(keys, 1, header.key_bytes, in) == header.key_bytes
+      && (header.key_bytes == 0 || keys_end[-1] == '\0')
+      && fseeko(in, (off_t) sizeof(header), SEEK_SET) == 0;
+
+  size_t batch_count = snapshot_batch(stride);
+  char* batch = ok ? malloc(batch_count * stride) : NULL;
+  ok = ok && batch != NULL;
+  char* key = keys;
+  struct node* tail = NULL;
+  size_t tail_bucket = 0;
+  for (size_t done = 0; done < header.total && ok; ) {
+    size_t count = header.total - done;
+    if (count > batch_count) {
+      count = batch_count;
+    }
+    if (fread(batch, stride, count, in) != count) {
+      ok = 0;
+      break;
+    }
+    for (size_t j = 0; j < count; j++) {
+      struct snapshot_record record;
+      memcpy(&record, batch + j * stride, sizeof(record));
+      struct node* node = (struct node*) (nodes + (done + j) * hash_table->node_size);
+      size_t bucket = hash_table_bucket(hash_table, record.hash);
+      if (bucket >= hash_table->size || record.key_len >= (uint64_t) (keys_end - key)
+          || key[record.key_len] != '\0') {
+        ok = 0;
+        break;
+      }
+      node->key = key;
+      node->hash = record.hash;
+      node->next = NULL;
+      memcpy(node_value(node), batch + j * stride + sizeof(record), header.value_size);
+      key += record.key_len + 1;
+
+      // Chains are stored contiguously and in order, so append at the tail.
+      if (tail != NULL && bucket == tail_bucket) {
+        tail->next = node;
+      } else if (hash_table->array[bucket] == NULL) {
+        hash_table->array[bucket] = node;
+      } else {
+        ok = 0;
+        break;
+      }
+      tail = node;
+      tail_bucket = bucket;
+    }
+    done += count;
+  }
+  free(batch);
+  fclose(in);
+
+  if (!ok || key != keys_end) {
+    hash_table_free(hash_table);
+    return NULL;
+  }
+  hash_table->total = (size_t) header.total;
+  chain_tree_scan(hash_table);
+  return hash_table;
+}
+
+/*
+ * Size of the buffer hash_table_dump() formats into before handing output to
+ * the sink.
+ */
+#define DUMP_BUFFER_SIZE (64 * 1024)
+
+/*
+ * Output buffer used while dumping a hash_table.
+ */
+struct dump_buffer {
+  hash_table_write_fn write;
+  void* ctx;
+  int failed;
+  size_t len;
+  char data[DUMP_BUFFER_SIZE];
+};
+
+/*
+ * Hands everything buffered so far to the sink.  Once the sink has failed,
+ * further output is discarded.
+ */
+static void dump_flush(struct dump_buffer* buf) {
+  if (buf->len > 0 && !buf->failed) {
+    if (buf->write(buf->ctx, buf->data, buf->len) != buf->len) {
+      buf->failed = 1;
+    }
+  }
+  buf->len = 0;
+}
+
+static void dump_bytes(struct dump_buffer* buf, const char* bytes, size_t len) {
+  while (len > 0) {
+    if (buf->len == DUMP_BUFFER_SIZE) {
+      dump_flush(buf);
+    }
+    size_t n = DUMP_BUFFER_SIZE - buf->len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(buf->data + buf->len, bytes, n);
+    buf->len += n;
+    bytes += n;
+    len -= n;
+  }
+}
+
+static void dump_char(struct dump_buffer* buf, char c) {
+  if (buf->len == DUMP_BUFFER_SIZE) {
+    dump_flush(buf);
+  }
+  buf->data[buf->len++] = c;
+}
+
+static void dump_str(struct dump_buffer* buf, const char* str) {
+  dump_bytes(buf, str, strlen(str));
+}
+
+/*
+ * Formats an integer without going through printf.
+ */
+static void dump_int(struct dump_buffer* buf, long value) {
+  char digits[24];
+  char* p = digits + sizeof(digits);
+  unsigned long u = value < 0 ? -(unsigned long) value : (unsigned long) value;
+  do {
+    *--p = (char) ('0' + u % 10);
+    u /= 10;
+  } while (u != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+  dump_bytes(buf, p, digits + sizeof(digits) - p);
+}
+
+/*
+ * Writes a key as a CSV field, quoting it only when it contains a separator,
+ * a quote or a line break.
+ */
+static void dump_csv_key(struct dump_buffer* buf, const char* key) {
+  if (key[strcspn(key, ",\"\r\n")] == '\0') {
+    dump_str(buf, key);
+    return;
+  }
+  dump_char(buf, '"');
+  for (; *key; key++) {
+    if (*key == '"') {
+      dump_char(buf, '"');
+    }
+    dump_char(buf, *key);
+  }
+  dump_char(buf, '"');
+}
+
+/*
+ * Writes a key as a JSON string literal.
+ */
+static void dump_json_key(struct dump_buffer* buf, const char* key) {
+  static const char hex[] = "0123456789abcdef";
+  dump_char(buf, '"');
+  const char* run = key;
+  for (; *key; key++) {
+    unsigned char c = (unsigned char) *key;
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    // Copy the unescaped run in one go, then the escape sequence.
+    dump_bytes(buf, run, key - run);
+    run = key + 1;
+    if (c == '"' || c == '\\') {
+      dump_char(buf, '\\');
+      dump_char(buf, (char) c);
+    } else {
+      char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+      dump_bytes(buf, esc, sizeof(esc));
+    }
+  }
+  dump_bytes(buf, run, key - run);
+  dump_char(buf, '"');
+}
+
+/*
+ * Writes a node's value: ints in decimal, anything else as the hex bytes of
+ * the inline value (for pointer payloads, the bytes of the pointer).  JSON
+ * gets the hex form as a string.
+ */
+static void dump_value(struct dump_buffer* buf, struct hash_table* hash_table,
+                       struct node* node, int json) {
+  static const char hex[] = "0123456789abcdef";
+  if (hash_table->int_values) {
+    dump_int(buf, node->value[0].i);
+    return;
+  }
+  const unsigned char* bytes = node_value(node);
+  if (json) {
+    dump_char(buf, '"');
+  }
+  dump_str(buf, "0x");
+  for (size_t i = 0; i < hash_table->value_size; i++) {
+    dump_char(buf, hex[bytes[i] >> 4]);
+    dump_char(buf, hex[bytes[i] & 0xf]);
+  }
+  if (json) {
+    dump_char(buf, '"');
+  }
+}
+
+/*
+ * Writes one element in the requested format.  "first" tells whether this is
+ * the first element written in the whole dump (JSON needs separators).
+ */
+static void dump_entry(struct dump_buffer* buf, struct hash_table* hash_table,
+                       enum hash_table_dump_format format,
+                       size_t bucket, struct node* node, int first) {
+  switch (format) {
+  case HASH_TABLE_DUMP_DISPLAY:
+    dump_str(buf, "->(key=");
+    dump_str(buf, node->key);
+    dump_str(buf, ",value=");
+    dump_value(buf, hash_table, node, 0);
+    dump_char(buf, ')');
+    break;
+  case HASH_TABLE_DUMP_COMPACT:
+    dump_int(buf, bucket);
+    dump_char(buf, '\t');
+    dump_str(buf, node->key);
+    dump_char(buf, '\t');
+    dump_value(buf, hash_table, node, 0);
+    dump_char(buf, '\n');
+    break;
+  case HASH_TABLE_DUMP_CSV:
+    dump_int(buf, bucket);
+    dump_char(buf, ',');
+    dump_csv_key(buf, node->key);
+    dump_char(buf, ',');
+    dump_value(buf, hash_table, node, 0);
+    dump_char(buf, '\n');
+    break;
+  case HASH_TABLE_DUMP_JSON:
+    dump_str(buf, first ? "\n  {\"bucket\":" : ",\n  {\"bucket\":");
+    dump_int(buf, bucket);
+    dump_str(buf, ",\"key\":");
+    dump_json_key(buf, node->key);
+    dump_str(buf, ",\"value\":");
+    dump_value(buf, hash_table, node, 1);
+    dump_char(buf, '}');
+    break;
+  }
+}
+
+/*
+ * Writes the contents of the hash_table to a sink through a large buffer.
+ */
+int hash_table_dump(struct hash_table* hash_table,
+                    const struct hash_table_dump_options* options,
+                    hash_table_write_fn write, void* ctx) {
+  assert(hash_table);
+  assert(write);
+
+  static const struct hash_table_dump_options defaults;
+  if (options == NULL) {
+    options = &defaults;
+  }
+  enum hash_table_dump_format format = options->format;
+  size_t first_bucket = options->first_bucket;
+  // A cuckoo table's stash or a hopscotch table's overflow list is dumped as
+  // one more bucket after the last.
+  size_t num_buckets = hash_table->size + (hash_table->array == NULL ? 1 : 0);
+  size_t last_bucket = options->last_bucket;
+  if (last_bucket == 0 || last_bucket > num_buckets) {
+    last_bucket = num_buckets;
+  }
+  size_t stride = options->stride > 1 ? options->stride : 1;
+  size_t remaining = options->max_entries > 0 ? options->max_entries : SIZE_MAX;
+
+  struct dump_buffer* buf = malloc(sizeof(struct dump_buffer));
+  assert(buf);
+  buf->write = write;
+  buf->ctx = ctx;
+  buf->failed = 0;
+  buf->len = 0;
+
+  // Header.
+  switch (format) {
+  case HASH_TABLE_DUMP_DISPLAY:
+    dump_str(buf, "Hash table, size=");
+    dump_int(buf, hash_table->size);
+    dump_str(buf, ", total=");
+    dump_int(buf, hash_table->total);
+    dump_char(buf, '\n');
+    break;
+  case HASH_TABLE_DUMP_CSV:
+    dump_str(buf, "bucket,key,value\n");
+    break;
+  case HASH_TABLE_DUMP_JSON:
+    dump_str(buf, "{\"size\":");
+    dump_int(buf, hash_table->size);
+    dump_str(buf, ",\"total\":");
+    dump_int(buf, hash_table->total);
+    dump_str(buf, ",\"entries\":[");
+    break;
+  default:
+    break;
+  }
+
+  size_t written = 0;
+  for (size_t i = first_bucket; i < last_bucket && remaining != 0 && !buf->failed; i += stride) {
+    struct node* slots[HOPSCOTCH_RANGE];
+    int num_slots = 0;
+    int slot = 0;
+    struct node* temp;
+    int in_slots = hash_table->array == NULL && i < hash_table->size;
+    if (in_slots) {
+      num_slots = hash_table->cuckoo != NULL ? cuckoo_bucket_nodes(hash_table, i, slots)
+                                             : hopscotch_bucket_nodes(hash_table, i, slots);
+      temp = num_slots > 0 ? slots[0] : NULL;
+    } else if (hash_table->cuckoo != NULL) {
+      temp = hash_table->cuckoo->stash;
+    } else if (hash_table->hopscotch != NULL) {
+      temp = hash_table->hopscotch->overflow;
     } else {
-      printf("array[%d]", i);
-      while (temp != NULL) {
-        printf("->(key=%s,value=%d)", temp->key, temp->value);
+      temp = bucket_head(hash_table, i);
+    }
+    if (format == HASH_TABLE_DUMP_DISPLAY) {
+      dump_str(buf, "array[");
+      dump_int(buf, i);
+      dump_char(buf, ']');
+    }
+    while (temp != NULL && remaining != 0) {
+      dump_entry(buf, hash_table, format, i, temp, written == 0);
+      written++;
+      remaining--;
+      if (in_slots) {
+        temp = ++slot < num_slots ? slots[slot] : NULL;
+      } else {
         temp = temp->next;
       }
-      printf("-|\n");
     }
+    if (format == HASH_TABLE_DUMP_DISPLAY) {
+      dump_str(buf, "-|\n");
+    }
+  }
+
+  // Trailer.
+  if (format == HASH_TABLE_DUMP_DISPLAY) {
+    dump_char(buf, '\n');
+  } else if (format == HASH_TABLE_DUMP_JSON) {
+    dump_str(buf, written > 0 ? "\n]}\n" : "]}\n");
+  }
+
+  dump_flush(buf);
+  int ok = !buf->failed;
+  free(buf);
+  return ok;
+}
+
+/*
+ * Sink writing to a stdio stream.
+ */
+static size_t dump_write_file(void* ctx, const char* buf, size_t len) {
+  return fwrite(buf, 1, len, (FILE*) ctx);
+}
+
+/*
+ * Sink writing to a file descriptor, retrying short writes.
+ */
+static size_t dump_write_fd(void* ctx, const char* buf, size_t len) {
+  int fd = *(int*) ctx;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, buf + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += (size_t) n;
   }
-  printf("\n");
+  return done;
+}
+
+int hash_table_dump_file(struct hash_table* hash_table,
+                         const struct hash_table_dump_options* options,
+                         FILE* out) {
+  assert(out);
+  return hash_table_dump(hash_table, options, dump_write_file, out);
+}
+
+int hash_table_dump_fd(struct hash_table* hash_table,
+                       const struct hash_table_dump_options* options,
+                       int fd) {
+  return hash_table_dump(hash_table, options, dump_write_fd, &fd);
+}
+
+/*
+ * Displays the content of the hash_table.
+ */
+void display(struct hash_table* hash_table) {
+  hash_table_dump_file(hash_table, NULL, stdout);
 }
@@ -5,6 +5,11 @@
 #ifndef __HASH_TABLE_H
 #define __HASH_TABLE_H
 
+#include <stdio.h>
+#include <stddef.h>
+
+#include "page_alloc.h"
+
 /*
  * Structure used to represent a hash table.
  */
@@ -13,19 +18,185 @@ struct hash_table;
 /*
  * compue the hash code for the key, version 1
  */
-int hash_function1(struct hash_table* hash_table, char* key);
+size_t hash_function1(struct hash_table* hash_table, char* key);
 
 /*
  * compue the hash code for the key, version 2. This is to be 
  * updated in the assignment, within the hash_table.c source code
  */
-int hash_function2(struct hash_table* hash_table, char* key);
+size_t hash_function2(struct hash_table* hash_table, char* key);
+
+/*
+ * compute the hash code for the key with SipHash, keyed by a random seed
+ * the table picks when it is created.  Unlike hash_function1() and
+ * hash_function2(), nobody outside the process can tell which keys collide.
+ */
+size_t hash_function_keyed(struct hash_table* hash_table, char* key);
+
+
+/*
+ * Hashing and key handling policy of a table.  It is fixed when the table is
+ * created (or while it is empty, see hash_table_set_policy()) so that every
+ * operation on the table hashes and compares keys the same way.
+ *
+ *   hash - returns the bucket index of a key, like hash_function1(),
+ *          hash_function2() and hash_function_keyed().  Those three are
+ *          recognized and computed inline, without an indirect call.
+ *   equal - returns nonzero if two keys are equal.  NULL means strcmp().
+ *   copy_key - returns the key to store for a new element.  NULL means the
+ *          table keeps a private copy.
+ *   free_key - releases a key returned by copy_key.  May be NULL.
+ *   key_ctx - passed to copy_key and free_key
+ */
+struct hash_policy {
+  size_t (*hash)(struct hash_table* hash_table, char* key);
+  int (*equal)(const char* a, const char* b);
+  char* (*copy_key)(void* key_ctx, const char* key);
+  void (*free_key)(void* key_ctx, char* key);
+  void* key_ctx;
+};
 
+/*
+ * Ready-made policies hashing with hash_function1(), hash_function2() and
+ * hash_function_keyed(), with strcmp() equality and private key copies.
+ * hash_policy_function2 is the default policy of new tables.
+ *
+ * hash_policy_keyed is for tables fed with keys from untrusted sources.
+ * Besides hashing with a secret seed, chained tables using it watch their
+ * chain lengths: a chain far longer than the load factor explains makes the
+ * table pick a new seed and rehash every element.
+ */
+extern const struct hash_policy hash_policy_function1;
+extern const struct hash_policy hash_policy_function2;
+extern const struct hash_policy hash_policy_keyed;
 
 /*
- * Creates a new, empty hash_table and returns a pointer to it.
+ * copy_key function for borrowed keys: the table stores the caller's key
+ * pointer itself.  Adding a key then neither allocates nor copies anything
+ * for it, and removing or resetting frees nothing.  The caller must keep
+ * every key alive and unchanged for as long as the table holds it.
+ */
+char* hash_key_borrow(void* key_ctx, const char* key);
+
+/*
+ * Makes policy borrow its keys: sets copy_key to hash_key_borrow() and
+ * clears free_key and key_ctx, leaving the hash and equal functions as they
+ * are.
+ */
+void hash_policy_borrow(struct hash_policy* policy);
+
+/*
+ * Creates a new, empty hash_table with int values and returns a pointer to it.
+ */
+struct hash_table* hash_table_create(size_t array_size);
+
+/*
+ * How a table stores its elements.
+ *
+ *   HASH_TABLE_CHAINED   - every bucket is a linked list of elements
+ *   HASH_TABLE_CUCKOO    - bucketized cuckoo hashing: every element sits in
+ *                          one of its two 4-slot buckets, or in a stash
+ *                          that is normally short, so lookups and removals
+ *                          read at most two buckets plus the stash.
+ *                          Insertions move other elements to make room, and
+ *                          the table doubles once the stash fills up under
+ *                          load.
+ *   HASH_TABLE_HOPSCOTCH - hopscotch hashing: every element sits in one of
+ *                          the 32 slots starting at its home slot, which
+ *                          keeps lookups short at loads of 90% and more.
+ *                          Home slots come from hash_function2 for both
+ *                          unkeyed built-in policies.  Elements whose
+ *                          neighborhood is full while the table is lightly
+ *                          loaded (keys whose hashes collide outright) go
+ *                          to an overflow list instead.
+ *
+ * Dumps of cuckoo and hopscotch tables list the stash or overflow list as one
+ * more bucket after the last.  If a key is added twice, lookups in these
+ * tables may find either element.  They cannot be saved, frozen or used with
+ * the parallel functions.
+ */
+enum hash_table_backend {
+  HASH_TABLE_CHAINED,
+  HASH_TABLE_CUCKOO,
+  HASH_TABLE_HOPSCOTCH
+};
+
+/*
+ * Options for hash_table_create_config().  Fields left zero get the same
+ * behaviour as hash_table_create().
+ *
+ *   array_size - the number of buckets
+ *   policy - how keys are hashed, compared and stored; NULL means
+ *                hash_policy_function2.  The policy is copied.
+ *   value_size - bytes of value stored inline with each key, for use with
+ *                hash_table_add_value() and hash_table_lookup(); 0 means the
+ *                table holds ints and is used with hash_table_add() and
+ *                hash_table_get()
+ *   pointer_values - if nonzero, each value is a void* payload owned by the
+ *                caller (value_size is ignored)
+ *   value_free - called for every value that leaves the table through
+ *                hash_table_remove(), hash_table_reset() or hash_table_free().
+ *                Receives the address of the inline value, or the payload
+ *                itself for pointer_values tables.  May be NULL.
+ *   fast_reset - if nonzero, nodes and key copies are carved out of large
+ *                blocks and every bucket carries a generation tag, so that
+ *                hash_table_reset() takes constant time: it moves the table
+ *                to a new generation (making all buckets empty) and releases
+ *                the blocks at once.  Memory of removed keys is reclaimed at
+ *                the next reset.  Without value_free or free_key callbacks,
+ *                nothing is visited element by element.
+ *   pow2 - if nonzero, array_size is rounded up to a power of two (at least
+ *                2) and bucket indices are taken from a 64-bit hash of the
+ *                key with a mask (hash_function1) or a multiply and shift
+ *                (hash_function2), so no operation divides or uses floating
+ *                point.  Custom hash functions see the rounded size.
+ *   pages - huge page backing and NUMA placement of the bucket array and of
+ *                the nodes and key copies (see page_alloc.h).  When set,
+ *                nodes and keys are carved out of large page-backed blocks
+ *                as with fast_reset, and the bucket array is mapped directly
+ *                so that it is zero-filled lazily, page by page.
+ *   backend - how elements are stored.  For HASH_TABLE_CUCKOO, array_size
+ *                is the number of 4-slot buckets, for HASH_TABLE_HOPSCOTCH
+ *                the number of home slots; either is rounded up as with
+ *                pow2.  fast_reset only provides the block allocation, since
+ *                these tables carry no generation tags.
+ *   filter_capacity - if nonzero, the table keeps a counting Bloom filter
+ *                sized for about this many elements (6 bytes each) in front
+ *                of its buckets (see bloom.h).  Lookups and removals of keys
+ *                the filter rules out return without visiting any bucket;
+ *                about 2% of absent keys get past it at that capacity.
+ *                Custom hash functions return bucket indices, so with them
+ *                the filter can only rule out keys of empty buckets.
+ *                Tables loaded from snapshots have no filter.
+ */
+struct hash_table_config {
+  size_t array_size;
+  const struct hash_policy* policy;
+  size_t value_size;
+  int pointer_values;
+  void (*value_free)(void* value);
+  int fast_reset;
+  int pow2;
+  struct page_options pages;
+  enum hash_table_backend backend;
+  size_t filter_capacity;
+};
+
+/*
+ * Creates a new, empty hash_table as described by config and returns a
+ * pointer to it.
+ */
+struct hash_table* hash_table_create_config(const struct hash_table_config* config);
+
+/*
+ * Replaces the policy of an empty hash_table, e.g. to reuse a table with a
+ * different hash function after hash_table_reset().
+ *
+ * Params:
+ *   hash_table - the hash_table to change.  Must be empty.
+ *   policy - the new policy, which is copied.  May not be NULL.
  */
-struct hash_table* hash_table_create(int array_size);
+void hash_table_set_policy(struct hash_table* hash_table, const struct hash_policy* policy);
 
 /*
  * Free all of the memory associated with a hash_table.
@@ -52,7 +223,17 @@ void hash_table_reset(struct hash_table* hash_table);
  *   hash_table - the hash_table onto which to add a value.  May not be NULL.
  *   value - the new value to be added onto the hash_table
  */
-void hash_table_add(struct hash_table* hash_table, int (*hf)(struct hash_table*, char*),char* key, int value);
+void hash_table_add(struct hash_table* hash_table, char* key, int value);
+
+/*
+ * add a new key with an arbitrary value onto a hash_table.
+ *
+ * Params:
+ *   hash_table - the hash_table onto which to add a value.  May not be NULL.
+ *   value - for inline tables, points to value_size bytes that are copied
+ *     into the table; for pointer_values tables, the payload itself
+ */
+void hash_table_add_value(struct hash_table* hash_table, char* key, const void* value);
 
 /*
  * Removes the front element from a hash_table and returns its value.
@@ -64,18 +245,165 @@ void hash_table_add(struct hash_table* hash_table, int (*hf)(struct hash_table*,
  *   returns 1 if the key was found and element removed, 0 otherwise
  */
 
-int hash_table_remove(struct hash_table* hash_table, int (*hf)(struct hash_table*, char*), char* key);
+int hash_table_remove(struct hash_table* hash_table, char* key);
+
+/*
+ * Looks up the value stored under a key.
+ *
+ * Params:
+ *   hash_table - the hash_table to search.  Must hold int values.
+ *   key - the key to look for
+ *   value - receives the value if the key is found.  May be NULL.
+ *
+ * Return:
+ *   returns 1 if the key was found, 0 otherwise
+ */
+int hash_table_get(struct hash_table* hash_table, char* key, int* value);
+
+/*
+ * Looks up the value stored under a key in a table of any value type.
+ *
+ * Return:
+ *   for inline tables, the address of the value inside the table (valid until
+ *   the element is removed); for pointer_values tables, the payload.  Returns
+ *   NULL if the key was not found.
+ */
+void* hash_table_lookup(struct hash_table* hash_table, char* key);
+
+/*
+ * Adds n keys at once, as hash_table_add_value() would one after the other.
+ * Keys are hashed in batches, several at a time, which is faster than
+ * adding them one by one.
+ *
+ * Params:
+ *   keys - the n keys to add
+ *   values - n values of the table's value_size bytes each, laid out one
+ *     after the other; for pointer_values tables, an array of n payloads
+ */
+void hash_table_add_batch(struct hash_table* hash_table, char** keys, const void* values, size_t n);
+
+/*
+ * Looks up n keys at once, hashing them in batches.  values[i] receives what
+ * hash_table_lookup() would return for keys[i].
+ *
+ * Return:
+ *   the number of keys found
+ */
+size_t hash_table_lookup_batch(struct hash_table* hash_table, char** keys, size_t n, void** values);
 
 /*
  * Counts the total number of collisions that occured in a full hash table 
+ * (for cuckoo and hopscotch tables, the elements outside their first-choice
+ * bucket or home slot)
  *
  * Params:
  *   hash_table - the hash_table to display
  *
  */
 
-int hash_table_collisions(struct hash_table* hash_table);
+size_t hash_table_collisions(struct hash_table* hash_table);
+
+/*
+ * Counters of a HASH_TABLE_CUCKOO table.
+ *
+ *   buckets - the current number of 4-slot buckets
+ *   kicks - elements moved to their other bucket to make room for others
+ *   stash_inserts - insertions that found no free slot and used the stash
+ *   stash_used - elements in the stash right now
+ *   grows - times the table doubled because the stash was full
+ */
+struct hash_table_cuckoo_stats {
+  size_t buckets;
+  size_t kicks;
+  size_t stash_inserts;
+  size_t stash_used;
+  size_t grows;
+};
+
+/*
+ * Reads the counters of a cuckoo table.
+ *
+ * Return:
+ *   returns 1 and fills in *stats for cuckoo tables, 0 for other tables
+ */
+int hash_table_cuckoo_stats(struct hash_table* hash_table, struct hash_table_cuckoo_stats* stats);
+
 
+/*
+ * Cursor over the elements of a hash table, in bucket order and then chain
+ * order.  It lives wherever the caller puts it (usually the stack), so
+ * iterating allocates nothing.  The fields are private to hash_table.c.
+ *
+ * The table must not be modified while an iterator is in use, except through
+ * hash_table_iter_remove() on that iterator.
+ */
+struct hash_table_iter {
+  struct hash_table* hash_table;
+  size_t bucket;
+  struct node** link;
+  struct node* node;
+};
+
+/*
+ * Positions an iterator before the first element of a hash table.
+ *
+ * Params:
+ *   hash_table - the hash_table to iterate over.  May not be NULL.
+ *   iter - the iterator to initialize.  May not be NULL.
+ */
+void hash_table_iter_begin(struct hash_table* hash_table, struct hash_table_iter* iter);
+
+/*
+ * Advances an iterator to the next element.
+ *
+ * Params:
+ *   iter - the iterator.  May not be NULL.
+ *   key - receives the element's key.  May be NULL.
+ *   value - receives the element's value, as hash_table_lookup() would
+ *     return it (for int tables, a pointer to the int).  May be NULL.
+ *
+ * Return:
+ *   returns 1 if the iterator moved to an element, 0 once all elements have
+ *   been visited
+ */
+int hash_table_iter_next(struct hash_table_iter* iter, const char** key, void** value);
+
+/*
+ * Removes the element the iterator is on from the table.  The next call to
+ * hash_table_iter_next() continues with the element that followed it.
+ *
+ * Params:
+ *   iter - an iterator positioned on an element.  May not be NULL.
+ */
+void hash_table_iter_remove(struct hash_table_iter* iter);
+
+/*
+ * What a hash_table_foreach() callback asks for after seeing an element.
+ */
+enum hash_table_visit {
+  HASH_TABLE_VISIT_CONTINUE,
+  HASH_TABLE_VISIT_REMOVE,
+  HASH_TABLE_VISIT_STOP
+};
+
+/*
+ * Calls visit on every element of a hash table, in iteration order.  The
+ * callback may remove the element it was given by returning
+ * HASH_TABLE_VISIT_REMOVE, or end the scan by returning
+ * HASH_TABLE_VISIT_STOP.
+ *
+ * Params:
+ *   hash_table - the hash_table to scan.  May not be NULL.
+ *   visit - called with each key, its value (as in hash_table_iter_next())
+ *     and ctx
+ *   ctx - opaque pointer passed through to visit
+ *
+ * Return:
+ *   returns the number of elements visited
+ */
+size_t hash_table_foreach(struct hash_table* hash_table,
+                          enum hash_table_visit (*visit)(const char* key, void* value, void* ctx),
+                          void* ctx);
 
 /*
  * Prints the contents of a hash table 
@@ -87,6 +415,108 @@ int hash_table_collisions(struct hash_table* hash_table);
 
 void display(struct hash_table* hash_table);
 
+/*
+ * Writes a hash table to a compact binary snapshot file: the table size and
+ * element count, then every element with its cached hash code.
+ *
+ * Params:
+ *   hash_table - the hash_table to save.  May not be NULL.  Tables holding
+ *     pointer payloads or values of more than 64 KiB cannot be saved.
+ *   path - the file to create or overwrite
+ *
+ * Return:
+ *   returns 1 if the snapshot was written, 0 otherwise
+ */
+int hash_table_save(struct hash_table* hash_table, const char* path);
+
+/*
+ * Recreates a hash table from a snapshot written by hash_table_save().  The
+ * elements are restored in a single bulk pass without rehashing any key, so
+ * the table must use the same hash function that built it.  Snapshots record
+ * which built-in hash function (if any) the table used.
+ *
+ * Params:
+ *   path - the snapshot file to read
+ *   policy - the policy of the saved table.  May be NULL if it hashed with
+ *     one of the built-in hash functions, in which case the matching
+ *     built-in policy is used.  Keyed tables keep their seed in the file.
+ *
+ * Return:
+ *   returns the new hash_table, or NULL if the file could not be read or is
+ *   not a valid snapshot
+ */
+struct hash_table* hash_table_load(const char* path, const struct hash_policy* policy);
+
+/*
+ * Output formats understood by hash_table_dump().
+ *
+ *   HASH_TABLE_DUMP_DISPLAY - the same layout display() prints
+ *   HASH_TABLE_DUMP_COMPACT - one "bucket<TAB>key<TAB>value" line per element
+ *   HASH_TABLE_DUMP_CSV     - "bucket,key,value" rows with a header line
+ *   HASH_TABLE_DUMP_JSON    - a single JSON object with an "entries" array
+ */
+enum hash_table_dump_format {
+  HASH_TABLE_DUMP_DISPLAY,
+  HASH_TABLE_DUMP_COMPACT,
+  HASH_TABLE_DUMP_CSV,
+  HASH_TABLE_DUMP_JSON
+};
+
+/*
+ * Selects what hash_table_dump() writes.  A zero-initialized structure dumps
+ * every bucket in HASH_TABLE_DUMP_DISPLAY format.
+ *
+ *   format      - one of the hash_table_dump_format values
+ *   first_bucket - index of the first bucket to dump
+ *   last_bucket - one past the last bucket to dump, 0 means "to the end"
+ *   stride      - dump every stride-th bucket of the range, 0 or 1 means all
+ *   max_entries - stop after this many elements, 0 means no limit
+ */
+struct hash_table_dump_options {
+  enum hash_table_dump_format format;
+  size_t first_bucket;
+  size_t last_bucket;
+  size_t stride;
+  size_t max_entries;
+};
+
+/*
+ * Output sink for hash_table_dump().  Called with large blocks of formatted
+ * text; must return the number of bytes it consumed (anything less than len
+ * aborts the dump).
+ */
+typedef size_t (*hash_table_write_fn)(void* ctx, const char* buf, size_t len);
+
+/*
+ * Writes the contents of a hash table to a caller-supplied sink.  Output is
+ * formatted into a large internal buffer and handed to the sink in blocks,
+ * so the cost is one sink call per block rather than one per element.
+ *
+ * Params:
+ *   hash_table - the hash_table to dump.  May not be NULL.
+ *   options - what to dump and how; NULL means the defaults described above
+ *   write - the sink receiving the formatted output.  May not be NULL.
+ *   ctx - opaque pointer passed through to the sink
+ *
+ * Return:
+ *   returns 1 if the whole dump was written, 0 if the sink failed
+ */
+int hash_table_dump(struct hash_table* hash_table,
+                    const struct hash_table_dump_options* options,
+                    hash_table_write_fn write, void* ctx);
+
+/*
+ * Convenience wrappers around hash_table_dump() writing to a stdio stream or
+ * to a raw file descriptor.  Same return value as hash_table_dump().
+ */
+int hash_table_dump_file(struct hash_table* hash_table,
+                         const struct hash_table_dump_options* options,
+                         FILE* out);
+
+int hash_table_dump_fd(struct hash_table* hash_table,
+                       const struct hash_table_dump_options* options,
+                       int fd);
+
 
 
 
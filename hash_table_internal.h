@@ -0,0 +1,354 @@
+/*
+ * This file contains the definition of the hash_table structure itself, for
+ * use by the modules that work directly on a table's buckets (e.g. the frozen
+ * table writer).  Users of the hash table should only include hash_table.h.
+ */
+
+#ifndef __HASH_TABLE_INTERNAL_H
+#define __HASH_TABLE_INTERNAL_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "node.h"
+#include "arena.h"
+#include "hash_table.h"
+#include "bloom.h"
+#include "perfect_hash.h"
+#include "siphash.h"
+
+/*
+ * Which hash function a table's policy uses.  The built-in ones are computed
+ * inline by hash_table_hash() and hash_table_bucket(); anything else is
+ * called through the policy.
+ */
+enum hash_kind {
+  HASH_KIND_CUSTOM,
+  HASH_KIND_FUNCTION1,
+  HASH_KIND_FUNCTION2,
+  HASH_KIND_KEYED
+};
+
+struct cuckoo_table;
+struct hopscotch_table;
+struct chain_tree;
+
+/*
+ * Definition of the hash_table structure.
+ * Uses an array of pointers to linked lists (buckets), the size of the table,
+ * and a total count of inserted elements.
+ *
+ * Nodes and keys are normally malloc'd one at a time.  A table loaded from a
+ * snapshot instead keeps them in an arena: nodes removed from such a table go
+ * onto free_nodes for reuse, and all of the memory is released at once.
+ *
+ * Every node carries value_size bytes of inline value and occupies node_size
+ * bytes.  int_values marks tables with plain int values (the int API);
+ * pointer_values marks tables whose values are void* payloads, for which
+ * value_free receives the payload rather than the address of the value.
+ *
+ * policy is the table's own copy of its hash_policy; hash_kind says whether
+ * its hash function is one of the built-in ones.  seed is the SipHash key
+ * of keyed tables, and reseed_total the element count at their last reseed.
+ *
+ * Tables created with fast_reset keep a generation tag per bucket in
+ * bucket_gen.  Only buckets tagged with the current generation hold nodes,
+ * so hash_table_reset() empties every bucket at once by bumping generation.
+ * bucket_gen is NULL in all other tables.
+ *
+ * pages is the table's huge page and NUMA placement; array_mapped and
+ * gen_mapped are the page_alloc() mapping lengths of array and bucket_gen.
+ *
+ * filter, if not NULL, holds the filter hash (hash_table_filter_hash()) of
+ * every element.
+ *
+ * Cuckoo and hopscotch tables keep their elements in cuckoo or hopscotch
+ * instead of array, which is NULL; both are NULL in chained tables.
+ *
+ * trees, allocated when the first chain grows long, holds the search tree of
+ * each treeified bucket (chain_tree.h), or NULL; tree_list links all of them
+ * and trees_mapped is the page_alloc() mapping length of trees.
+ *
+ * In pow2 tables size is a power of two, at least 2; mask is size - 1 and
+ * shift is 64 - log2(size), for reducing 64-bit hashes to bucket indices.
+ */
+struct hash_table {
+  struct node** array;
+  size_t size;
+  size_t total;
+  struct arena* arena;
+  struct node* free_nodes;
+  size_t value_size;
+  size_t node_size;
+  int int_values;
+  int pointer_values;
+  void (*value_free)(void* value);
+  struct hash_policy policy;
+  enum hash_kind hash_kind;
+  uint64_t seed[2];
+  size_t reseed_total;
+  unsigned int* bucket_gen;
+  unsigned int generation;
+  struct page_options pages;
+  size_t array_mapped;
+  size_t gen_mapped;
+  struct cuckoo_table* cuckoo;
+  struct hopscotch_table* hopscotch;
+  struct bloom_filter* filter;
+  struct chain_tree** trees;
+  size_t trees_mapped;
+  struct chain_tree* tree_list;
+  int pow2;
+  size_t mask;
+  unsigned int shift;
+};
+
+/*
+ * Returns the first node of bucket i.  In tables with generation tags, a
+ * bucket whose tag is not the current generation is stale and reads as
+ * empty.  Use this for every read of a bucket head.
+ */
+static inline struct node* bucket_head(struct hash_table* hash_table, size_t i) {
+  if (hash_table->bucket_gen != NULL && hash_table->bucket_gen[i] != hash_table->generation) {
+    return NULL;
+  }
+  return hash_table->array[i];
+}
+
+/*
+ * Returns the address of bucket i's head pointer, for code that links or
+ * unlinks nodes.  A stale bucket is emptied and brought up to the current
+ * generation first.
+ */
+static inline struct node** bucket_link(struct hash_table* hash_table, size_t i) {
+  if (hash_table->bucket_gen != NULL && hash_table->bucket_gen[i] != hash_table->generation) {
+    hash_table->array[i] = NULL;
+    hash_table->bucket_gen[i] = hash_table->generation;
+  }
+  return &hash_table->array[i];
+}
+
+/*
+ * Returns the search tree of bucket i, or NULL if its chain is not treeified.
+ */
+static inline struct chain_tree* bucket_tree(struct hash_table* hash_table, size_t i) {
+  return hash_table->trees != NULL ? hash_table->trees[i] : NULL;
+}
+
+/*
+ * Releases a node that has already been unlinked from its bucket, calling
+ * the table's value_free and free_key callbacks.  For heap tables this only
+ * calls free(), so it may be used from several threads at once.
+ */
+void node_destroy(struct hash_table* hash_table, struct node* node);
+
+/*
+ * Reseeds a keyed chained table if one of its chains has grown too long, as
+ * adding elements one at a time would have.  Used after filling a table in
+ * bulk, which bypasses the check.
+ */
+void hash_table_guard_chains(struct hash_table* hash_table);
+
+/*
+ * Stores the hash_table_hash() of each of the n keys at keys in hashes,
+ * using the batch hash functions (hash_batch.h) where there is one for the
+ * table's policy.
+ */
+void hash_table_hash_batch(struct hash_table* hash_table, char** keys, size_t n, uint64_t* hashes);
+
+/*
+ * Sets the bucket count of a table.  With pow2, size is rounded up to a power
+ * of two (at least 2) and the mask and shift are derived from it.
+ */
+static inline void hash_table_set_size(struct hash_table* hash_table, size_t size, int pow2) {
+  hash_table->pow2 = pow2 != 0;
+  hash_table->mask = 0;
+  hash_table->shift = 0;
+  if (hash_table->pow2) {
+    unsigned int bits = 1;
+    while (((size_t) 1 << bits) < size) {
+      bits++;
+    }
+    size = (size_t) 1 << bits;
+    hash_table->mask = size - 1;
+    hash_table->shift = 64 - bits;
+  }
+  hash_table->size = size;
+}
+
+/*
+ * The built-in hash functions are split in two: a 64-bit hash of the key,
+ * which nodes cache, and its reduction to a bucket index.
+ */
+static inline uint64_t hash_raw_function1(const char* key) {
+  return (unsigned char) key[0];
+}
+
+/*
+ * Powers of 31 for taking function2 hashes eight characters at a time.
+ */
+#define HASH_POW31_1 UINT64_C(31)
+#define HASH_POW31_2 UINT64_C(961)
+#define HASH_POW31_3 UINT64_C(29791)
+#define HASH_POW31_4 UINT64_C(923521)
+#define HASH_POW31_5 UINT64_C(28629151)
+#define HASH_POW31_6 UINT64_C(887503681)
+#define HASH_POW31_7 UINT64_C(27512614111)
+#define HASH_POW31_8 UINT64_C(852891037441)
+
+static inline uint64_t hash_raw_function2(const char* key) {
+  uint64_t hash_val = 0;
+  size_t len = strlen(key);
+
+  // Convert the entire string to an integer using a multiplier of 31.  Eight
+  // steps of hash_val * 31 + c at once come to one multiply by 31^8 plus
+  // eight products that do not wait on each other.
+  for (; len >= 8; len -= 8, key += 8) {
+    hash_val = hash_val * HASH_POW31_8
+               + (uint64_t) key[0] * HASH_POW31_7 + (uint64_t) key[1] * HASH_POW31_6
+               + (uint64_t) key[2] * HASH_POW31_5 + (uint64_t) key[3] * HASH_POW31_4
+               + (uint64_t) key[4] * HASH_POW31_3 + (uint64_t) key[5] * HASH_POW31_2
+               + (uint64_t) key[6] * HASH_POW31_1 + (uint64_t) key[7];
+  }
+  for (; len > 0; len--) {
+    hash_val = hash_val * 31 + (uint64_t) *key++;
+  }
+  return hash_val;
+}
+
+/*
+ * Reduces a function1 hash: modulo the size, or a mask in pow2 tables.
+ */
+static inline size_t hash_reduce_function1(struct hash_table* hash_table, uint64_t hash) {
+  if (hash_table->pow2) {
+    return (size_t) hash & hash_table->mask;
+  }
+  return (size_t) (hash % hash_table->size);
+}
+
+static inline uint64_t hash_raw_keyed(struct hash_table* hash_table, const char* key) {
+  return siphash(hash_table->seed, key, strlen(key));
+}
+
+/*
+ * Reduces a function2 hash by multiplicative hashing: multiply by A, take the
+ * fractional part, then scale.  pow2 tables do the same in fixed point, with
+ * A = 2^64 / golden ratio, keeping the top log2(size) bits of the product.
+ */
+static inline size_t hash_reduce_function2(struct hash_table* hash_table, uint64_t hash) {
+  if (hash_table->pow2) {
+    return (size_t) ((hash * UINT64_C(0x9E3779B97F4A7C15)) >> hash_table->shift);
+  }
+  double A = 0.6180339887;
+  double product = (double) hash * A;
+  double frac = product - (uint64_t) product;  // fractional part extraction
+  return (size_t) (frac * hash_table->size);
+}
+
+/*
+ * Reduces a keyed hash, whose bits are all equally good: a mask in pow2
+ * tables, modulo the size otherwise.
+ */
+static inline size_t hash_reduce_keyed(struct hash_table* hash_table, uint64_t hash) {
+  if (hash_table->pow2) {
+    return (size_t) hash & hash_table->mask;
+  }
+  return (size_t) (hash % hash_table->size);
+}
+
+/*
+ * Returns the hash of key under the table's policy, as cached in its node.
+ * For custom policies this is the bucket index itself.
+ */
+static inline uint64_t hash_table_hash(struct hash_table* hash_table, char* key) {
+  switch (hash_table->hash_kind) {
+  case HASH_KIND_FUNCTION1:
+    return hash_raw_function1(key);
+  case HASH_KIND_FUNCTION2:
+    return hash_raw_function2(key);
+  case HASH_KIND_KEYED:
+    return hash_raw_keyed(hash_table, key);
+  default:
+    return hash_table->policy.hash(hash_table, key);
+  }
+}
+
+/*
+ * Returns the bucket index of a hash from hash_table_hash().
+ */
+static inline size_t hash_table_bucket(struct hash_table* hash_table, uint64_t hash) {
+  switch (hash_table->hash_kind) {
+  case HASH_KIND_FUNCTION1:
+    return hash_reduce_function1(hash_table, hash);
+  case HASH_KIND_FUNCTION2:
+    return hash_reduce_function2(hash_table, hash);
+  case HASH_KIND_KEYED:
+    return hash_reduce_keyed(hash_table, hash);
+  default:
+    return (size_t) hash;
+  }
+}
+
+/*
+ * Returns the hash a table's filter is keyed by, given hash, the hash a node
+ * holding key caches: hash_table_hash() in chained tables, the cuckoo or
+ * hopscotch hash otherwise.  Hashes are mixed so that their low bits spread
+ * over the filter; function1's hash in chained tables (one character) would
+ * say too little about the key, so the whole key is hashed instead.
+ */
+static inline uint64_t hash_table_filter_hash(struct hash_table* hash_table, uint64_t hash, const char* key) {
+  if (hash_table->hash_kind == HASH_KIND_FUNCTION1 && hash_table->array != NULL) {
+    return perfect_hash_key(key, 0);
+  }
+  return perfect_hash_mix(hash);
+}
+
+/*
+ * Returns the bucket index of key under the table's policy.
+ */
+static inline size_t hash_table_index(struct hash_table* hash_table, char* key) {
+  return hash_table_bucket(hash_table, hash_table_hash(hash_table, key));
+}
+
+/*
+ * Returns nonzero if two keys are equal under the table's policy.  The same
+ * pointer is always equal to itself, which makes comparing interned keys
+ * (intern.h) a pointer comparison.
+ */
+static inline int hash_table_equal(struct hash_table* hash_table, const char* a, const char* b) {
+  if (a == b) {
+    return 1;
+  }
+  if (hash_table->policy.equal == NULL) {
+    return strcmp(a, b) == 0;
+  }
+  return hash_table->policy.equal(a, b);
+}
+
+/*
+ * Returns nonzero if node holds key, whose hash is hash.  The cached hashes
+ * are compared first, so keys are only compared in full (however long they
+ * are) when they are almost certainly equal.
+ */
+static inline int hash_table_match(struct hash_table* hash_table, const struct node* node,
+                                   uint64_t hash, const char* key) {
+  return node->hash == hash && hash_table_equal(hash_table, node->key, key);
+}
+
+/*
+ * Returns the hash_kind of a policy.
+ */
+static inline enum hash_kind hash_policy_kind(const struct hash_policy* policy) {
+  if (policy->hash == hash_function1) {
+    return HASH_KIND_FUNCTION1;
+  }
+  if (policy->hash == hash_function2) {
+    return HASH_KIND_FUNCTION2;
+  }
+  if (policy->hash == hash_function_keyed) {
+    return HASH_KIND_KEYED;
+  }
+  return HASH_KIND_CUSTOM;
+}
+
+#endif
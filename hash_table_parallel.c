@@ -0,0 +1,352 @@
+/*
+ * This file contains the definitions of functions implementing parallel
+ * full-table scans of a hash_table.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "node.h"
+#include "arena.h"
+#include "hash_table.h"
+#include "hash_table_internal.h"
+#include "chain_tree.h"
+#include "hash_table_parallel.h"
+#include "thread_pool.h"
+
+/*
+ * Ranges per thread.  More ranges than threads lets fast threads pick up
+ * the slack when chains are unevenly spread.
+ */
+#define RANGES_PER_THREAD 8
+
+/*
+ * Per-range partial result, padded to its own cache line so that threads do
+ * not contend on neighbouring results.
+ */
+struct scan_result {
+  long long value;
+  char pad[64 - sizeof(long long)];
+};
+
+/*
+ * One parallel scan: scan_range() is applied to every bucket range and its
+ * return value is stored in that range's result.
+ */
+struct scan_job {
+  struct hash_table* hash_table;
+  int num_ranges;
+  long long (*scan_range)(struct scan_job* job, size_t first, size_t last);
+  struct scan_result* results;
+  void (*visit)(const char* key, void* value, void* ctx);
+  long long (*map)(const char* key, void* value, void* ctx);
+  void* ctx;
+};
+
+static void scan_task(void* ctx, int index) {
+  struct scan_job* job = ctx;
+  size_t size = job->hash_table->size;
+  size_t first = size * index / job->num_ranges;
+  size_t last = size * (index + 1) / job->num_ranges;
+  job->results[index].value = job->scan_range(job, first, last);
+}
+
+/*
+ * Runs scan_range over the whole bucket array and returns the sum of the
+ * per-range results.
+ */
+static long long scan_run(struct scan_job* job, struct thread_pool* pool) {
+  assert(job->hash_table);
+  assert(job->hash_table->array);
+  assert(pool);
+  int num_ranges = thread_pool_size(pool) * RANGES_PER_THREAD;
+  if ((size_t) num_ranges > job->hash_table->size) {
+    num_ranges = (int) job->hash_table->size;
+  }
+  job->num_ranges = num_ranges;
+  job->results = malloc(num_ranges * sizeof(struct scan_result));
+  assert(job->results);
+  thread_pool_run(pool, scan_task, job, num_ranges);
+
+  long long total = 0;
+  for (int i = 0; i < num_ranges; i++) {
+    total += job->results[i].value;
+  }
+  free(job->results);
+  return total;
+}
+
+static void* scan_value(struct hash_table* hash_table, struct node* node) {
+  return hash_table->pointer_values ? node->value[0].p : (void*) node->value;
+}
+
+static long long scan_foreach_range(struct scan_job* job, size_t first, size_t last) {
+  struct hash_table* hash_table = job->hash_table;
+  for (size_t i = first; i < last; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      job->visit(temp->key, scan_value(hash_table, temp), job->ctx);
+    }
+  }
+  return 0;
+}
+
+static long long scan_reduce_range(struct scan_job* job, size_t first, size_t last) {
+  struct hash_table* hash_table = job->hash_table;
+  long long sum = 0;
+  for (size_t i = first; i < last; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      sum += job->map(temp->key, scan_value(hash_table, temp), job->ctx);
+    }
+  }
+  return sum;
+}
+
+static long long scan_sum_range(struct scan_job* job, size_t first, size_t last) {
+  struct hash_table* hash_table = job->hash_table;
+  long long sum = 0;
+  for (size_t i = first; i < last; i++) {
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      sum += temp->value[0].i;
+    }
+  }
+  return sum;
+}
+
+static long long scan_collisions_range(struct scan_job* job, size_t first, size_t last) {
+  struct hash_table* hash_table = job->hash_table;
+  long long num_col = 0;
+  for (size_t i = first; i < last; i++) {
+    size_t count = 0;
+    for (struct node* temp = bucket_head(hash_table, i); temp != NULL; temp = temp->next) {
+      count++;
+    }
+    if (count > 1) {
+      num_col += count - 1;
+    }
+  }
+  return num_col;
+}
+
+static long long scan_free_range(struct scan_job* job, size_t first, size_t last) {
+  struct hash_table* hash_table = job->hash_table;
+  for (size_t i = first; i < last; i++) {
+    struct node* current = bucket_head(hash_table, i);
+    while (current != NULL) {
+      struct node* next = current->next;
+      node_destroy(hash_table, current);
+      current = next;
+    }
+    hash_table->array[i] = NULL;
+  }
+  return 0;
+}
+
+void hash_table_parallel_foreach(struct hash_table* hash_table, struct thread_pool* pool,
+                                 void (*visit)(const char* key, void* value, void* ctx),
+                                 void* ctx) {
+  assert(visit);
+  struct scan_job job = { hash_table, 0, scan_foreach_range, NULL, visit, NULL, ctx };
+  scan_run(&job, pool);
+}
+
+long long hash_table_parallel_reduce(struct hash_table* hash_table, struct thread_pool* pool,
+                                     long long (*map)(const char* key, void* value, void* ctx),
+                                     void* ctx) {
+  assert(map);
+  struct scan_job job = { hash_table, 0, scan_reduce_range, NULL, NULL, map, ctx };
+  return scan_run(&job, pool);
+}
+
+long long hash_table_parallel_sum(struct hash_table* hash_table, struct thread_pool* pool) {
+  assert(hash_table);
+  assert(hash_table->int_values);
+  struct scan_job job = { hash_table, 0, scan_sum_range, NULL, NULL, NULL, NULL };
+  return scan_run(&job, pool);
+}
+
+size_t hash_table_parallel_collisions(struct hash_table* hash_table, struct thread_pool* pool) {
+  struct scan_job job = { hash_table, 0, scan_collisions_range, NULL, NULL, NULL, NULL };
+  return (size_t) scan_run(&job, pool);
+}
+
+/*
+ * Tears the chains down in parallel.  Arena tables have no per-node memory
+ * to give back, so they take the ordinary path.
+ */
+void hash_table_parallel_free(struct hash_table* hash_table, struct thread_pool* pool) {
+  assert(hash_table);
+  chain_tree_free_all(hash_table);
+  if (hash_table->arena == NULL) {
+    struct scan_job job = { hash_table, 0, scan_free_range, NULL, NULL, NULL, NULL };
+    scan_run(&job, pool);
+    hash_table->total = 0;
+  }
+  hash_table_free(hash_table);
+}
+
+/*
+ * State of a parallel build.  The input is cut into num_parts chunks and the
+ * bucket array into num_parts partitions; hashes and buckets hold each key's
+ * hash and bucket index; counts[c * num_parts + p] is the
+ * number of keys of chunk c that fall in partition p, turned into the offset
+ * of that group in "order" (key indices grouped by partition, each group in
+ * input order).
+ */
+struct build_job {
+  struct hash_table* hash_table;
+  char** keys;
+  const char* values;
+  size_t n;
+  int num_parts;
+  uint64_t* hashes;
+  size_t* buckets;
+  size_t* counts;
+  size_t* order;
+  size_t* part_start;
+  struct arena* arenas;
+};
+
+static size_t build_chunk_first(struct build_job* job, int chunk) {
+  return job->n * chunk / job->num_parts;
+}
+
+static size_t build_partition(struct build_job* job, size_t bucket) {
+  return bucket * job->num_parts / job->hash_table->size;
+}
+
+/*
+ * Pass 1, per input chunk: hash every key and count keys per partition.
+ */
+static void build_hash_task(void* ctx, int chunk) {
+  struct build_job* job = ctx;
+  size_t* counts = &job->counts[(size_t) chunk * job->num_parts];
+  size_t first = build_chunk_first(job, chunk);
+  size_t last = build_chunk_first(job, chunk + 1);
+  hash_table_hash_batch(job->hash_table, job->keys + first, last - first, job->hashes + first);
+  for (size_t i = first; i < last; i++) {
+    job->buckets[i] = hash_table_bucket(job->hash_table, job->hashes[i]);
+    counts[build_partition(job, job->buckets[i])]++;
+  }
+}
+
+/*
+ * Pass 2, per input chunk: scatter key indices into their partition groups.
+ */
+static void build_scatter_task(void* ctx, int chunk) {
+  struct build_job* job = ctx;
+  size_t* offsets = &job->counts[(size_t) chunk * job->num_parts];
+  size_t last = build_chunk_first(job, chunk + 1);
+  for (size_t i = build_chunk_first(job, chunk); i < last; i++) {
+    job->order[offsets[build_partition(job, job->buckets[i])]++] = i;
+  }
+}
+
+/*
+ * Pass 3, per partition: create the nodes in the partition's own arena and
+ * push them onto their chains in input order.
+ */
+static void build_link_task(void* ctx, int part) {
+  struct build_job* job = ctx;
+  struct hash_table* hash_table = job->hash_table;
+  struct hash_policy* policy = &hash_table->policy;
+  struct arena* arena = &job->arenas[part];
+  for (size_t j = job->part_start[part]; j < job->part_start[part + 1]; j++) {
+    size_t i = job->order[j];
+    struct node* node = arena_alloc(arena, hash_table->node_size);
+    if (policy->copy_key == NULL) {
+      size_t key_size = strlen(job->keys[i]) + 1;
+      node->key = arena_alloc(arena, key_size);
+      memcpy(node->key, job->keys[i], key_size);
+    } else {
+      node->key = policy->copy_key(policy->key_ctx, job->keys[i]);
+      assert(node->key);
+    }
+    memcpy(node->value, job->values + i * hash_table->value_size, hash_table->value_size);
+    node->hash = job->hashes[i];
+    struct node** head = bucket_link(hash_table, job->buckets[i]);
+    node->next = *head;
+    *head = node;
+  }
+}
+
+struct hash_table* hash_table_parallel_build(const struct hash_table_config* config,
+                                             struct thread_pool* pool,
+                                             char** keys, const void* values, size_t n) {
+  assert(pool);
+  assert(config->backend == HASH_TABLE_CHAINED);
+  assert(n == 0 || (keys && values));
+
+  struct hash_table* hash_table = hash_table_create_config(config);
+  if (hash_table->arena == NULL) {
+    hash_table->arena = malloc(sizeof(struct arena));
+    assert(hash_table->arena);
+    arena_init(hash_table->arena, 64 * 1024);
+  }
+
+  struct build_job job;
+  job.hash_table = hash_table;
+  job.keys = keys;
+  job.values = values;
+  job.n = n;
+  job.num_parts = thread_pool_size(pool) * RANGES_PER_THREAD;
+  if ((size_t) job.num_parts > hash_table->size) {
+    job.num_parts = (int) hash_table->size;
+  }
+  int num_parts = job.num_parts;
+  job.hashes = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+  job.buckets = malloc((n > 0 ? n : 1) * sizeof(size_t));
+  job.order = malloc((n > 0 ? n : 1) * sizeof(size_t));
+  job.counts = calloc((size_t) num_parts * num_parts, sizeof(size_t));
+  job.part_start = malloc((num_parts + 1) * sizeof(size_t));
+  job.arenas = malloc(num_parts * sizeof(struct arena));
+  assert(job.hashes && job.buckets && job.order && job.counts && job.part_start && job.arenas);
+
+  thread_pool_run(pool, build_hash_task, &job, num_parts);
+
+  // Turn the counts into offsets: partition-major, then chunk order, so each
+  // partition's keys end up contiguous and in input order.
+  size_t offset = 0;
+  for (int p = 0; p < num_parts; p++) {
+    job.part_start[p] = offset;
+    for (int c = 0; c < num_parts; c++) {
+      size_t count = job.counts[(size_t) c * num_parts + p];
+      job.counts[(size_t) c * num_parts + p] = offset;
+      offset += count;
+    }
+  }
+  job.part_start[num_parts] = offset;
+  assert(offset == n);
+
+  thread_pool_run(pool, build_scatter_task, &job, num_parts);
+
+  for (int p = 0; p < num_parts; p++) {
+    arena_init_pages(&job.arenas[p], hash_table->arena->chunk_size, &hash_table->arena->pages);
+  }
+  thread_pool_run(pool, build_link_task, &job, num_parts);
+  for (int p = 0; p < num_parts; p++) {
+    arena_merge(hash_table->arena, &job.arenas[p]);
+  }
+  hash_table->total = n;
+
+  // Filter counters are packed four bits apiece, so the filter is filled
+  // here rather than by the partition threads.
+  if (hash_table->filter != NULL) {
+    for (size_t i = 0; i < n; i++) {
+      bloom_add(hash_table->filter, hash_table_filter_hash(hash_table, job.hashes[i], keys[i]));
+    }
+  }
+
+  // The chain guard of keyed tables and the trees of long chains each take
+  // one pass over the finished table.
+  hash_table_guard_chains(hash_table);
+  chain_tree_scan(hash_table);
+
+  free(job.hashes);
+  free(job.buckets);
+  free(job.order);
+  free(job.counts);
+  free(job.part_start);
+  free(job.arenas);
+  return hash_table;
+}
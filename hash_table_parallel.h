@@ -0,0 +1,84 @@
+/*
+ * This file contains the definition of an interface for full-table scans
+ * that split a hash table's bucket array across the threads of a
+ * thread_pool.  Each thread walks its own contiguous range of buckets.
+ *
+ * None of these functions may run while another thread modifies the table.
+ */
+
+#ifndef __HASH_TABLE_PARALLEL_H
+#define __HASH_TABLE_PARALLEL_H
+
+#include "hash_table.h"
+#include "thread_pool.h"
+
+/*
+ * Calls visit on every element of a hash table, from several threads at
+ * once.  visit must be safe to call concurrently and must not modify the
+ * table.  Elements of one bucket are visited in chain order by one thread.
+ *
+ * Params:
+ *   hash_table - the hash_table to scan.  May not be NULL.
+ *   pool - the threads to scan with.  May not be NULL.
+ *   visit - called with each key, its value (as in hash_table_iter_next())
+ *     and ctx
+ *   ctx - opaque pointer passed through to visit
+ */
+void hash_table_parallel_foreach(struct hash_table* hash_table, struct thread_pool* pool,
+                                 void (*visit)(const char* key, void* value, void* ctx),
+                                 void* ctx);
+
+/*
+ * Maps every element of a hash table to a number and returns the sum,
+ * computed in parallel.  map has the same requirements as the visit
+ * callback of hash_table_parallel_foreach().
+ */
+long long hash_table_parallel_reduce(struct hash_table* hash_table, struct thread_pool* pool,
+                                     long long (*map)(const char* key, void* value, void* ctx),
+                                     void* ctx);
+
+/*
+ * Returns the sum of all values of a hash table holding int values (e.g.
+ * the total inventory), computed in parallel.
+ */
+long long hash_table_parallel_sum(struct hash_table* hash_table, struct thread_pool* pool);
+
+/*
+ * Parallel version of hash_table_collisions().
+ */
+size_t hash_table_parallel_collisions(struct hash_table* hash_table, struct thread_pool* pool);
+
+/*
+ * Parallel version of hash_table_free().  The table's value_free and
+ * free_key callbacks, if any, are called from several threads at once.
+ */
+void hash_table_parallel_free(struct hash_table* hash_table, struct thread_pool* pool);
+
+/*
+ * Builds a hash table from arrays of keys and values using several threads.
+ *
+ * The input is split into chunks that are hashed in parallel, and each key is
+ * routed to the partition (contiguous bucket range) its bucket falls in.
+ * Each thread then builds the chains of its own partitions, with the nodes
+ * and key copies in an arena of its own, so no two threads ever touch the
+ * same bucket or allocator.  The result is the table that calling
+ * hash_table_add_value() for each pair in order would produce.  Its storage
+ * is arena-backed like a table from hash_table_load().
+ *
+ * Params:
+ *   config - the table to create, as for hash_table_create_config().  A
+ *     custom policy's hash and copy_key are called from several threads.
+ *   pool - the threads to build with.  May not be NULL.
+ *   keys - the n keys
+ *   values - n values of the table's value type, stored contiguously (an
+ *     int array for int tables, an array of void* for pointer tables)
+ *   n - the number of pairs
+ *
+ * Return:
+ *   returns the new hash_table
+ */
+struct hash_table* hash_table_parallel_build(const struct hash_table_config* config,
+                                             struct thread_pool* pool,
+                                             char** keys, const void* values, size_t n);
+
+#endif
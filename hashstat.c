@@ -0,0 +1,317 @@
+/*
+ * This file contains a tool that measures the quality and speed of the hash
+ * functions tables can use.
+ *
+ * Usage: hashstat [-p] CORPUS SIZE
+ *
+ * CORPUS holds one key per line (blank lines are ignored).  Every hash in
+ * the hashes[] list below is run over it as a table of SIZE buckets would
+ * run it (-p: a pow2 table), and for each one the tool reports:
+ *
+ *   - throughput: ns/key and GB/s of computing bucket indices, over the
+ *     whole corpus and per key length class;
+ *   - chi-squared of the bucket counts against a uniform spread, as the
+ *     ratio chi2/df, which is about 1 for a good hash;
+ *   - the longest chain;
+ *   - the expected probe length of a successful lookup in a chained table,
+ *     next to what a uniform spread would give;
+ *   - avalanche: how often each bit of the 64-bit hash flips when one input
+ *     bit flips, averaged (ideal 0.5) and at the worst output bit.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for clock_gettime()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash_table.h"
+#include "hash_table_internal.h"
+
+#define MAX_LINE 4096
+
+/*
+ * Minimum time spent timing each hash over the corpus, and over each key
+ * length class, in seconds.
+ */
+#define TIME_TOTAL 0.2
+#define TIME_CLASS 0.05
+
+/*
+ * At most this many keys are put through the avalanche test.
+ */
+#define AVALANCHE_KEYS 2000
+
+/*
+ * The hashes to evaluate.  A new hash function gets a policy and a line here.
+ */
+static const struct {
+  const char* name;
+  const struct hash_policy* policy;
+} hashes[] = {
+  { "function1", &hash_policy_function1 },
+  { "function2", &hash_policy_function2 },
+  { "keyed", &hash_policy_keyed },
+};
+
+/*
+ * Key length classes for the throughput breakdown, by largest length.
+ */
+static const size_t length_classes[] = { 8, 16, 32, 64, 256, (size_t) -1 };
+#define NUM_CLASSES (sizeof(length_classes) / sizeof(length_classes[0]))
+
+/*
+ * Keys of the corpus and their lengths.
+ */
+struct corpus {
+  char** keys;
+  size_t* lengths;
+  size_t n;
+  size_t bytes;
+};
+
+/*
+ * Reads the corpus file.  Returns 1, or 0 after reporting a line that is too
+ * long.
+ */
+static int read_corpus(FILE* in, const char* path, struct corpus* corpus) {
+  char line[MAX_LINE];
+  size_t capacity = 1024;
+  corpus->keys = malloc(capacity * sizeof(char*));
+  corpus->lengths = malloc(capacity * sizeof(size_t));
+  assert(corpus->keys && corpus->lengths);
+  corpus->n = 0;
+  corpus->bytes = 0;
+
+  for (int line_no = 1; fgets(line, sizeof(line), in) != NULL; line_no++) {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      fprintf(stderr, "%s:%d: line too long\n", path, line_no);
+      return 0;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0) {
+      continue;
+    }
+
+    if (corpus->n == capacity) {
+      capacity *= 2;
+      corpus->keys = realloc(corpus->keys, capacity * sizeof(char*));
+      corpus->lengths = realloc(corpus->lengths, capacity * sizeof(size_t));
+      assert(corpus->keys && corpus->lengths);
+    }
+    corpus->keys[corpus->n] = malloc(len + 1);
+    assert(corpus->keys[corpus->n]);
+    memcpy(corpus->keys[corpus->n], line, len + 1);
+    corpus->lengths[corpus->n] = len;
+    corpus->bytes += len;
+    corpus->n++;
+  }
+  return 1;
+}
+
+static double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+/*
+ * Bucket indices are summed into sink so that the timed loops cannot be
+ * optimized away.
+ */
+static volatile size_t sink;
+
+/*
+ * Computes the bucket index of the n keys at keys over and over for at least
+ * min_time seconds.  Returns the time per pass.
+ */
+static double time_pass(struct hash_table* hash_table, char** keys, size_t n, double min_time) {
+  size_t passes = 0;
+  size_t sum = 0;
+  double start = now_seconds();
+  double elapsed;
+  do {
+    for (size_t i = 0; i < n; i++) {
+      sum += hash_table_index(hash_table, keys[i]);
+    }
+    passes++;
+    elapsed = now_seconds() - start;
+  } while (elapsed < min_time);
+  sink += sum;
+  return elapsed / (double) passes;
+}
+
+/*
+ * Prints ns/key and GB/s over the whole corpus and per length class.
+ */
+static void report_throughput(struct hash_table* hash_table, const struct corpus* corpus) {
+  double pass = time_pass(hash_table, corpus->keys, corpus->n, TIME_TOTAL);
+  printf("  throughput      %8.2f ns/key  %6.2f GB/s\n",
+         pass * 1e9 / (double) corpus->n, (double) corpus->bytes / pass * 1e-9);
+
+  char** keys = malloc(corpus->n * sizeof(char*));
+  assert(keys);
+  size_t smallest = 0;
+  for (size_t c = 0; c < NUM_CLASSES; c++) {
+    size_t n = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < corpus->n; i++) {
+      if (corpus->lengths[i] > smallest && corpus->lengths[i] <= length_classes[c]) {
+        keys[n++] = corpus->keys[i];
+        bytes += corpus->lengths[i];
+      }
+    }
+    if (n > 0) {
+      pass = time_pass(hash_table, keys, n, TIME_CLASS);
+      char label[32];
+      if (length_classes[c] == (size_t) -1) {
+        snprintf(label, sizeof(label), "%zu+", smallest + 1);
+      } else {
+        snprintf(label, sizeof(label), "%zu-%zu", smallest + 1, length_classes[c]);
+      }
+      printf("    len %-9s %8.2f ns/key  %6.2f GB/s  (%zu keys)\n",
+             label, pass * 1e9 / (double) n, (double) bytes / pass * 1e-9, n);
+    }
+    smallest = length_classes[c];
+  }
+  free(keys);
+}
+
+/*
+ * Prints chi-squared, the longest chain and the expected probe length of the
+ * corpus spread over the table's buckets.
+ */
+static void report_spread(struct hash_table* hash_table, const struct corpus* corpus) {
+  size_t* counts = calloc(hash_table->size, sizeof(size_t));
+  assert(counts);
+  for (size_t i = 0; i < corpus->n; i++) {
+    counts[hash_table_index(hash_table, corpus->keys[i])]++;
+  }
+
+  double expected = (double) corpus->n / (double) hash_table->size;
+  double chi2 = 0;
+  double probes = 0;
+  size_t max_chain = 0;
+  for (size_t b = 0; b < hash_table->size; b++) {
+    double diff = (double) counts[b] - expected;
+    chi2 += diff * diff / expected;
+    // The i-th element of a chain takes i probes to find.
+    probes += (double) counts[b] * ((double) counts[b] + 1) / 2;
+    if (counts[b] > max_chain) {
+      max_chain = counts[b];
+    }
+  }
+  free(counts);
+
+  double df = hash_table->size > 1 ? (double) (hash_table->size - 1) : 1;
+  printf("  chi2/df         %8.3f\n", chi2 / df);
+  printf("  max chain       %8zu  (load %.2f)\n", max_chain, expected);
+  printf("  probe length    %8.3f  (uniform %.3f)\n", probes / (double) corpus->n,
+         1 + ((double) corpus->n - 1) / (2 * (double) hash_table->size));
+}
+
+/*
+ * Prints how often the output bits of the 64-bit hash flip when single
+ * input bits flip.  Flips that would turn a byte into the terminator are
+ * skipped.
+ */
+static void report_avalanche(struct hash_table* hash_table, const struct corpus* corpus) {
+  size_t flips[64] = { 0 };
+  size_t trials = 0;
+  char buffer[MAX_LINE];
+  size_t step = corpus->n > AVALANCHE_KEYS ? corpus->n / AVALANCHE_KEYS : 1;
+  for (size_t i = 0; i < corpus->n; i += step) {
+    memcpy(buffer, corpus->keys[i], corpus->lengths[i] + 1);
+    uint64_t hash = hash_table_hash(hash_table, buffer);
+    for (size_t byte = 0; byte < corpus->lengths[i]; byte++) {
+      for (int bit = 0; bit < 8; bit++) {
+        buffer[byte] ^= (char) (1 << bit);
+        if (buffer[byte] != '\0') {
+          uint64_t diff = hash ^ hash_table_hash(hash_table, buffer);
+          for (int out = 0; out < 64; out++) {
+            flips[out] += (diff >> out) & 1;
+          }
+          trials++;
+        }
+        buffer[byte] ^= (char) (1 << bit);
+      }
+    }
+  }
+  if (trials == 0) {
+    return;
+  }
+
+  double total = 0;
+  double worst = 0;
+  for (int out = 0; out < 64; out++) {
+    double p = (double) flips[out] / (double) trials;
+    total += p;
+    double bias = p > 0.5 ? p - 0.5 : 0.5 - p;
+    if (bias > worst) {
+      worst = bias;
+    }
+  }
+  printf("  avalanche       %8.3f  (worst bit off by %.3f)\n", total / 64, worst);
+}
+
+int main(int argc, char** argv) {
+  int pow2 = 0;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "-p") == 0) {
+    pow2 = 1;
+    arg++;
+  }
+  char* end = NULL;
+  unsigned long long size = argc - arg == 2 ? strtoull(argv[arg + 1], &end, 10) : 0;
+  if (argc - arg != 2 || *end != '\0' || size == 0) {
+    fprintf(stderr, "usage: %s [-p] CORPUS SIZE\n", argv[0]);
+    return 2;
+  }
+  const char* path = argv[arg];
+
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  struct corpus corpus;
+  int ok = read_corpus(in, path, &corpus);
+  fclose(in);
+  if (!ok) {
+    return 1;
+  }
+  if (corpus.n == 0) {
+    fprintf(stderr, "%s: no keys\n", path);
+    return 1;
+  }
+
+  printf("%zu keys, %zu bytes, ", corpus.n, corpus.bytes);
+  for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = (size_t) size;
+    config.pow2 = pow2;
+    config.policy = hashes[h].policy;
+    struct hash_table* hash_table = hash_table_create_config(&config);
+    if (h == 0) {
+      printf("%zu buckets%s\n", hash_table->size, pow2 ? " (pow2)" : "");
+    }
+
+    printf("\n%s\n", hashes[h].name);
+    report_throughput(hash_table, &corpus);
+    report_spread(hash_table, &corpus);
+    report_avalanche(hash_table, &corpus);
+    hash_table_free(hash_table);
+  }
+
+  for (size_t i = 0; i < corpus.n; i++) {
+    free(corpus.keys[i]);
+  }
+  free(corpus.keys);
+  free(corpus.lengths);
+  return ferror(stdout) ? 1 : 0;
+}
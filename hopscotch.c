@@ -0,0 +1,356 @@
+/*
+ * This file contains the definitions of functions implementing the
+ * hopscotch backend of hash_table.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "node.h"
+#include "page_alloc.h"
+#include "hash_table.h"
+#include "hash_table_internal.h"
+#include "perfect_hash.h"
+#include "hopscotch.h"
+
+/*
+ * Home slots come from the function2 string hash for both unkeyed built-in
+ * policies: neighborhoods only work if keys spread over many home slots,
+ * which hash_function1 (the first character) cannot do.  Keyed tables use
+ * their SipHash.  Custom policies have their hash mixed, since they define
+ * which keys are equal.
+ */
+uint64_t hopscotch_hash(struct hash_table* hash_table, const char* key) {
+  if (hash_table->hash_kind == HASH_KIND_CUSTOM) {
+    return perfect_hash_mix((uint64_t) hash_table->policy.hash(hash_table, (char*) key));
+  }
+  if (hash_table->hash_kind == HASH_KIND_KEYED) {
+    return hash_raw_keyed(hash_table, key);
+  }
+  return hash_raw_function2(key);
+}
+
+/*
+ * The home slot is the function2 reduction of the hash (multiply by the
+ * golden ratio, keep the top bits), which spreads the weak low bits of short
+ * keys.
+ */
+static size_t hopscotch_home(struct hash_table* hash_table, uint64_t hash) {
+  return hash_reduce_function2(hash_table, hash);
+}
+
+static size_t hopscotch_num_slots(struct hash_table* hash_table) {
+  return hash_table->size + HOPSCOTCH_RANGE - 1;
+}
+
+/*
+ * Allocates the zeroed slots of a table with n home slots, aligned to a
+ * cache line.
+ */
+static void hopscotch_alloc_slots(struct hash_table* hash_table, struct hopscotch_table* hop, size_t n) {
+  assert(n <= (SIZE_MAX - 64) / sizeof(struct hopscotch_slot) - HOPSCOTCH_RANGE);
+  size_t bytes = (n + HOPSCOTCH_RANGE - 1) * sizeof(struct hopscotch_slot) + 64;
+  hop->block = page_alloc(bytes, &hash_table->pages, &hop->mapped);
+  assert(hop->block);
+  hop->slots = (struct hopscotch_slot*) (((uintptr_t) hop->block + 63) & ~(uintptr_t) 63);
+}
+
+struct hopscotch_table* hopscotch_create(struct hash_table* hash_table) {
+  assert(hash_table->pow2);
+  struct hopscotch_table* hop = malloc(sizeof(struct hopscotch_table));
+  assert(hop);
+  memset(hop, 0, sizeof(struct hopscotch_table));
+  hopscotch_alloc_slots(hash_table, hop, hash_table->size);
+  return hop;
+}
+
+void hopscotch_clear(struct hash_table* hash_table) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  size_t num_slots = hopscotch_num_slots(hash_table);
+  for (size_t i = 0; i < num_slots; i++) {
+    if (hop->slots[i].node != NULL) {
+      node_destroy(hash_table, hop->slots[i].node);
+    }
+  }
+  memset(hop->slots, 0, num_slots * sizeof(struct hopscotch_slot));
+  struct node* temp = hop->overflow;
+  while (temp != NULL) {
+    struct node* next = temp->next;
+    node_destroy(hash_table, temp);
+    temp = next;
+  }
+  hop->overflow = NULL;
+  hop->overflow_used = 0;
+}
+
+void hopscotch_free(struct hash_table* hash_table) {
+  hopscotch_clear(hash_table);
+  page_free(hash_table->hopscotch->block, hash_table->hopscotch->mapped);
+  free(hash_table->hopscotch);
+  hash_table->hopscotch = NULL;
+}
+
+/*
+ * Moves the free slot at index free closer to the front: finds the earliest
+ * element before it that may move there without leaving its neighborhood,
+ * moves it, and returns the index it came from.  Returns free unchanged if
+ * no element can move.
+ */
+static size_t hopscotch_move_closer(struct hopscotch_table* hop, size_t free) {
+  for (size_t home = free - (HOPSCOTCH_RANGE - 1); home < free; home++) {
+    uint32_t candidates = hop->slots[home].hop & (((uint32_t) 1 << (free - home)) - 1);
+    if (candidates == 0) {
+      continue;
+    }
+    unsigned int d = 0;
+    while (!(candidates & 1)) {
+      candidates >>= 1;
+      d++;
+    }
+    size_t from = home + d;
+    hop->slots[free].node = hop->slots[from].node;
+    hop->slots[free].hash = hop->slots[from].hash;
+    hop->slots[from].node = NULL;
+    hop->slots[home].hop = (hop->slots[home].hop & ~((uint32_t) 1 << d)) | (uint32_t) 1 << (free - home);
+    return from;
+  }
+  return free;
+}
+
+/*
+ * Puts a node into its neighborhood: finds the nearest free slot by linear
+ * probing and, while it is out of range, swaps it backwards with elements
+ * that can move forward.
+ *
+ * Returns 1 if the node was placed, 0 if no free slot could be brought into
+ * range.
+ */
+static int hopscotch_place(struct hash_table* hash_table, struct node* node) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  size_t home = hopscotch_home(hash_table, node->hash);
+  size_t limit = hopscotch_num_slots(hash_table);
+  if (limit - home > HOPSCOTCH_SEARCH) {
+    limit = home + HOPSCOTCH_SEARCH;
+  }
+  size_t free = home;
+  while (free < limit && hop->slots[free].node != NULL) {
+    free++;
+  }
+  if (free == limit) {
+    return 0;
+  }
+  while (free - home >= HOPSCOTCH_RANGE) {
+    size_t from = hopscotch_move_closer(hop, free);
+    if (from == free) {
+      return 0;
+    }
+    free = from;
+  }
+  hop->slots[free].node = node;
+  hop->slots[free].hash = (uint32_t) node->hash;
+  hop->slots[home].hop |= (uint32_t) 1 << (free - home);
+  return 1;
+}
+
+/*
+ * Pushes a node onto the overflow list.
+ */
+static void hopscotch_overflow(struct hopscotch_table* hop, struct node* node) {
+  node->next = hop->overflow;
+  hop->overflow = node;
+  hop->overflow_used++;
+}
+
+/*
+ * A custom policy's hash is a bucket index for the current size, so after a
+ * resize the cached hashes of its nodes are recomputed.
+ */
+static void hopscotch_rehash(struct hash_table* hash_table, struct node* node) {
+  if (hash_table->hash_kind == HASH_KIND_CUSTOM) {
+    node->hash = hopscotch_hash(hash_table, node->key);
+  }
+}
+
+/*
+ * Doubles the number of home slots and places every element again; those
+ * that still do not fit go to the new overflow list.
+ */
+static void hopscotch_grow(struct hash_table* hash_table) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  struct hopscotch_table old = *hop;
+  size_t old_slots = hopscotch_num_slots(hash_table);
+  hash_table_set_size(hash_table, hash_table->size * 2, 1);
+  hopscotch_alloc_slots(hash_table, hop, hash_table->size);
+  hop->overflow = NULL;
+  hop->overflow_used = 0;
+  for (size_t i = 0; i < old_slots; i++) {
+    struct node* node = old.slots[i].node;
+    if (node == NULL) {
+      continue;
+    }
+    hopscotch_rehash(hash_table, node);
+    if (!hopscotch_place(hash_table, node)) {
+      hopscotch_overflow(hop, node);
+    }
+  }
+  struct node* temp = old.overflow;
+  while (temp != NULL) {
+    struct node* next = temp->next;
+    hopscotch_rehash(hash_table, temp);
+    if (!hopscotch_place(hash_table, temp)) {
+      hopscotch_overflow(hop, temp);
+    }
+    temp = next;
+  }
+  page_free(old.block, old.mapped);
+}
+
+/*
+ * A node that does not fit goes to the overflow list.  Once that list is
+ * full and the table is loaded enough the table grows first, since the
+ * failure is then most likely due to load rather than to colliding hashes.
+ */
+void hopscotch_insert(struct hash_table* hash_table, struct node* node) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  if (hopscotch_place(hash_table, node)) {
+    return;
+  }
+  if (hop->overflow_used >= HOPSCOTCH_OVERFLOW_SIZE
+      && hash_table->total * 16 >= hash_table->size * HOPSCOTCH_GROW_LOAD) {
+    hopscotch_grow(hash_table);
+    hopscotch_rehash(hash_table, node);
+    if (hopscotch_place(hash_table, node)) {
+      return;
+    }
+  }
+  hopscotch_overflow(hop, node);
+}
+
+/*
+ * Finds the slot holding key, whose hash is hash: returns the address of its
+ * node pointer (a slot, the overflow head or an overflow node's next field),
+ * or NULL.  *index is the slot's index, or the number of slots for overflow
+ * links.
+ */
+static struct node** hopscotch_slot(struct hash_table* hash_table, const char* key, uint64_t hash,
+                                    size_t* index) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  size_t home = hopscotch_home(hash_table, hash);
+  uint32_t bits = hop->slots[home].hop;
+  for (size_t i = home; bits != 0; i++, bits >>= 1) {
+    if ((bits & 1) && hop->slots[i].hash == (uint32_t) hash
+        && hash_table_equal(hash_table, hop->slots[i].node->key, key)) {
+      *index = i;
+      return &hop->slots[i].node;
+    }
+  }
+  *index = hopscotch_num_slots(hash_table);
+  for (struct node** link = &hop->overflow; *link != NULL; link = &(*link)->next) {
+    if (hash_table_match(hash_table, *link, hash, key)) {
+      return link;
+    }
+  }
+  return NULL;
+}
+
+struct node* hopscotch_find(struct hash_table* hash_table, const char* key, uint64_t hash) {
+  size_t index;
+  struct node** slot = hopscotch_slot(hash_table, key, hash, &index);
+  return slot != NULL ? *slot : NULL;
+}
+
+/*
+ * Empties the slot at index, whose node pointer is at link: clears the hop
+ * bit of the element's home slot, or unlinks it from the overflow list.
+ */
+static void hopscotch_empty_slot(struct hash_table* hash_table, struct node** link, size_t index) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  if (index == hopscotch_num_slots(hash_table)) {
+    *link = (*link)->next;
+    hop->overflow_used--;
+    return;
+  }
+  size_t home = hopscotch_home(hash_table, (*link)->hash);
+  hop->slots[home].hop &= ~((uint32_t) 1 << (index - home));
+  *link = NULL;
+}
+
+struct node* hopscotch_unlink(struct hash_table* hash_table, const char* key, uint64_t hash) {
+  size_t index;
+  struct node** slot = hopscotch_slot(hash_table, key, hash, &index);
+  if (slot == NULL) {
+    return NULL;
+  }
+  struct node* node = *slot;
+  hopscotch_empty_slot(hash_table, slot, index);
+  return node;
+}
+
+/*
+ * iter->bucket is the index of the current slot.  Along the overflow list
+ * "link" works as for chains, so removing the current node leaves link on
+ * the next.
+ */
+int hopscotch_iter_next(struct hash_table_iter* iter) {
+  struct hash_table* hash_table = iter->hash_table;
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  size_t num_slots = hopscotch_num_slots(hash_table);
+  size_t i = iter->bucket;
+  if (i > num_slots) {
+    return 0;
+  }
+  if (i < num_slots) {
+    for (i += iter->link != NULL ? 1 : 0; i < num_slots; i++) {
+      if (hop->slots[i].node != NULL) {
+        iter->bucket = i;
+        iter->link = &hop->slots[i].node;
+        iter->node = *iter->link;
+        return 1;
+      }
+    }
+    iter->bucket = num_slots;
+    iter->link = &hop->overflow;
+    iter->node = NULL;
+  }
+  if (iter->node != NULL) {
+    iter->link = &iter->node->next;
+  }
+  if (*iter->link != NULL) {
+    iter->node = *iter->link;
+    return 1;
+  }
+  iter->bucket = num_slots + 1;
+  iter->node = NULL;
+  return 0;
+}
+
+void hopscotch_iter_unlink(struct hash_table_iter* iter) {
+  hopscotch_empty_slot(iter->hash_table, iter->link, iter->bucket);
+}
+
+int hopscotch_bucket_nodes(struct hash_table* hash_table, size_t i, struct node** nodes) {
+  assert(i < hash_table->size);
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  int count = 0;
+  uint32_t bits = hop->slots[i].hop;
+  for (size_t j = i; bits != 0; j++, bits >>= 1) {
+    if (bits & 1) {
+      nodes[count++] = hop->slots[j].node;
+    }
+  }
+  return count;
+}
+
+size_t hopscotch_displaced(struct hash_table* hash_table) {
+  struct hopscotch_table* hop = hash_table->hopscotch;
+  size_t displaced = hop->overflow_used;
+  for (size_t i = 0; i < hash_table->size; i++) {
+    uint32_t bits = hop->slots[i].hop >> 1;
+    for (; bits != 0; bits &= bits - 1) {
+      displaced++;
+    }
+  }
+  return displaced;
+}
@@ -0,0 +1,129 @@
+/*
+ * This file contains the definition of the hopscotch backend of hash_table
+ * (HASH_TABLE_HOPSCOTCH).  It is used by hash_table.c only; users of the hash
+ * table should only include hash_table.h.
+ *
+ * Every element lives in one slot of an open-addressed array, within
+ * HOPSCOTCH_RANGE slots of its home slot.  Each home slot keeps a bitmap of
+ * which of the following slots hold its elements, so a lookup only reads the
+ * slots whose bits are set, which stays cheap even at high load.  Elements
+ * are the same struct node as in chained tables; only their placement
+ * differs.
+ */
+
+#ifndef __HOPSCOTCH_H
+#define __HOPSCOTCH_H
+
+#include <stdint.h>
+
+#include "node.h"
+#include "hash_table.h"
+
+/*
+ * Size of a neighborhood: an element is at most HOPSCOTCH_RANGE - 1 slots
+ * past its home slot.  One bit of a hop bitmap per slot.
+ */
+#define HOPSCOTCH_RANGE 32
+
+/*
+ * How far past its home slot an insertion looks for a free slot to move
+ * towards the neighborhood.
+ */
+#define HOPSCOTCH_SEARCH 512
+
+/*
+ * Number of elements the overflow list holds before the table grows, and the
+ * load (in 1/16ths) the table must have reached as well.  Below that load a
+ * full neighborhood means that too many hashes collide outright, which no
+ * number of slots can fix, so the element is chained in the overflow list.
+ */
+#define HOPSCOTCH_OVERFLOW_SIZE 8
+#define HOPSCOTCH_GROW_LOAD 8
+
+/*
+ * One slot.  hop has bit d set if slot i + d holds an element whose home is
+ * slot i; hash is the cached hash of node, so candidates can be rejected and
+ * elements moved without touching the nodes.  A NULL node marks a free slot.
+ */
+struct hopscotch_slot {
+  struct node* node;
+  uint32_t hop;
+  uint32_t hash;
+};
+
+/*
+ * Definition of the hopscotch_table structure.  Home slots are 0 to the
+ * owning table's size - 1 (a power of two); slots holds HOPSCOTCH_RANGE - 1
+ * more after them so that neighborhoods never wrap around.  slots points
+ * into block, aligned to a cache line; mapped is block's page_alloc()
+ * mapping length.  overflow is a list linked through the nodes' next fields
+ * (unused otherwise) and overflow_used its length.
+ */
+struct hopscotch_table {
+  void* block;
+  size_t mapped;
+  struct hopscotch_slot* slots;
+  struct node* overflow;
+  size_t overflow_used;
+};
+
+/*
+ * Creates the slots of a hopscotch table for hash_table, whose size must
+ * already be set.
+ */
+struct hopscotch_table* hopscotch_create(struct hash_table* hash_table);
+
+/*
+ * Destroys every element (see hopscotch_clear()) and frees the slots.
+ */
+void hopscotch_free(struct hash_table* hash_table);
+
+/*
+ * Releases every element with node_destroy() and empties all slots.
+ */
+void hopscotch_clear(struct hash_table* hash_table);
+
+/*
+ * Returns the hash of key that hopscotch tables cache in their nodes.
+ */
+uint64_t hopscotch_hash(struct hash_table* hash_table, const char* key);
+
+/*
+ * Places a node whose hash is set, growing the table if it does not fit.
+ */
+void hopscotch_insert(struct hash_table* hash_table, struct node* node);
+
+/*
+ * Returns the node holding key, whose hopscotch_hash() is hash, or NULL.
+ */
+struct node* hopscotch_find(struct hash_table* hash_table, const char* key, uint64_t hash);
+
+/*
+ * Takes the node holding key, whose hopscotch_hash() is hash, out of the
+ * table and returns it, or returns NULL if there is none.  The node is not
+ * destroyed.
+ */
+struct node* hopscotch_unlink(struct hash_table* hash_table, const char* key, uint64_t hash);
+
+/*
+ * Iteration: positions run over every slot in order and then along the
+ * overflow list, which counts as the slot after the last.
+ * hopscotch_iter_next() advances iter to the next element, setting
+ * iter->link and iter->node, and returns 0 at the end;
+ * hopscotch_iter_unlink() empties the slot the iterator is on.
+ */
+int hopscotch_iter_next(struct hash_table_iter* iter);
+void hopscotch_iter_unlink(struct hash_table_iter* iter);
+
+/*
+ * Copies the nodes whose home is slot i (nearest first) into nodes, which
+ * needs room for HOPSCOTCH_RANGE of them, and returns how many there are.
+ */
+int hopscotch_bucket_nodes(struct hash_table* hash_table, size_t i, struct node** nodes);
+
+/*
+ * Returns the number of elements that are not in their home slot.
+ */
+size_t hopscotch_displaced(struct hash_table* hash_table);
+
+#endif
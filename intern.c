@@ -0,0 +1,234 @@
+/*
+ * This file contains the definitions of functions implementing a pool of
+ * interned keys.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "siphash.h"
+#include "intern.h"
+
+/*
+ * The pool is split into INTERN_SHARDS independent tables, each with its own
+ * lock, so that threads interning different keys rarely wait for each other.
+ * A key's shard is taken from the top bits of its hash, its bucket within
+ * the shard from the bottom bits.
+ */
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_INITIAL_SIZE 8
+
+/*
+ * One interned key.  The key is stored inline, so the entry of a key handed
+ * out by the pool is found from the key pointer alone.  The hash is not
+ * kept: it is recomputed from the key when the entry moves or goes away.
+ */
+struct intern_entry {
+  struct intern_entry* next;
+  uint32_t len;
+  uint32_t refs;
+  char key[];
+};
+
+/*
+ * One shard: a chained table of entries whose bucket count doubles when it
+ * holds more entries than buckets.  lock serializes every operation on it.
+ */
+struct intern_shard {
+  struct intern_entry** buckets;
+  size_t size;
+  size_t count;
+  pthread_mutex_t lock;
+};
+
+/*
+ * Definition of the intern_pool structure.  Keys are hashed with SipHash
+ * under a random seed, so no set of keys can be made to pile up in one
+ * shard or chain.
+ */
+struct intern_pool {
+  uint64_t seed[2];
+  struct intern_shard shards[INTERN_SHARDS];
+};
+
+static struct intern_entry* entry_of(char* key) {
+  return (struct intern_entry*) (key - offsetof(struct intern_entry, key));
+}
+
+static uint64_t intern_hash(struct intern_pool* pool, const char* key, size_t len) {
+  return siphash(pool->seed, key, len);
+}
+
+static struct intern_shard* intern_shard(struct intern_pool* pool, uint64_t hash) {
+  return &pool->shards[hash >> (64 - INTERN_SHARD_BITS)];
+}
+
+static struct intern_entry** intern_bucket(struct intern_shard* shard, uint64_t hash) {
+  return &shard->buckets[hash & (shard->size - 1)];
+}
+
+struct intern_pool* intern_pool_create(void) {
+  struct intern_pool* pool = malloc(sizeof(struct intern_pool));
+  assert(pool);
+  siphash_random_key(pool->seed);
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    struct intern_shard* shard = &pool->shards[i];
+    shard->size = INTERN_INITIAL_SIZE;
+    shard->count = 0;
+    shard->buckets = calloc(shard->size, sizeof(struct intern_entry*));
+    assert(shard->buckets);
+    pthread_mutex_init(&shard->lock, NULL);
+  }
+  return pool;
+}
+
+void intern_pool_free(struct intern_pool* pool) {
+  assert(pool);
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    struct intern_shard* shard = &pool->shards[i];
+    for (size_t j = 0; j < shard->size; j++) {
+      struct intern_entry* entry = shard->buckets[j];
+      while (entry != NULL) {
+        struct intern_entry* next = entry->next;
+        free(entry);
+        entry = next;
+      }
+    }
+    pthread_mutex_destroy(&shard->lock);
+    free(shard->buckets);
+  }
+  free(pool);
+}
+
+/*
+ * Doubles the bucket count of a shard.  The caller holds its lock.
+ */
+static void intern_grow(struct intern_pool* pool, struct intern_shard* shard) {
+  struct intern_entry** old = shard->buckets;
+  size_t old_size = shard->size;
+  shard->size *= 2;
+  shard->buckets = calloc(shard->size, sizeof(struct intern_entry*));
+  assert(shard->buckets);
+  for (size_t i = 0; i < old_size; i++) {
+    struct intern_entry* entry = old[i];
+    while (entry != NULL) {
+      struct intern_entry* next = entry->next;
+      struct intern_entry** bucket = intern_bucket(shard, intern_hash(pool, entry->key, entry->len));
+      entry->next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+  free(old);
+}
+
+/*
+ * Returns the entry of key, whose length is len and hash is hash, or NULL.
+ * The caller holds the shard's lock.
+ */
+static struct intern_entry* intern_lookup(struct intern_shard* shard, const char* key,
+                                          size_t len, uint64_t hash) {
+  for (struct intern_entry* entry = *intern_bucket(shard, hash); entry != NULL; entry = entry->next) {
+    if (entry->len == len && memcmp(entry->key, key, len) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+char* intern_pool_intern(struct intern_pool* pool, const char* key) {
+  assert(pool);
+  assert(key);
+  size_t len = strlen(key);
+  assert(len <= UINT32_MAX);
+  uint64_t hash = intern_hash(pool, key, len);
+  struct intern_shard* shard = intern_shard(pool, hash);
+
+  pthread_mutex_lock(&shard->lock);
+  struct intern_entry* entry = intern_lookup(shard, key, len, hash);
+  if (entry == NULL) {
+    entry = malloc(sizeof(struct intern_entry) + len + 1);
+    assert(entry);
+    entry->len = (uint32_t) len;
+    entry->refs = 0;
+    memcpy(entry->key, key, len + 1);
+    if (shard->count >= shard->size) {
+      intern_grow(pool, shard);
+    }
+    struct intern_entry** bucket = intern_bucket(shard, hash);
+    entry->next = *bucket;
+    *bucket = entry;
+    shard->count++;
+  }
+  assert(entry->refs < UINT32_MAX);
+  entry->refs++;
+  pthread_mutex_unlock(&shard->lock);
+  return entry->key;
+}
+
+void intern_pool_release(struct intern_pool* pool, char* key) {
+  assert(pool);
+  assert(key);
+  struct intern_entry* entry = entry_of(key);
+  uint64_t hash = intern_hash(pool, key, entry->len);
+  struct intern_shard* shard = intern_shard(pool, hash);
+
+  pthread_mutex_lock(&shard->lock);
+  assert(entry->refs > 0);
+  if (--entry->refs == 0) {
+    struct intern_entry** link = intern_bucket(shard, hash);
+    while (*link != entry) {
+      assert(*link);
+      link = &(*link)->next;
+    }
+    *link = entry->next;
+    shard->count--;
+    free(entry);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+const char* intern_pool_find(struct intern_pool* pool, const char* key) {
+  assert(pool);
+  assert(key);
+  size_t len = strlen(key);
+  uint64_t hash = intern_hash(pool, key, len);
+  struct intern_shard* shard = intern_shard(pool, hash);
+  pthread_mutex_lock(&shard->lock);
+  struct intern_entry* entry = intern_lookup(shard, key, len, hash);
+  pthread_mutex_unlock(&shard->lock);
+  return entry != NULL ? entry->key : NULL;
+}
+
+size_t intern_pool_size(struct intern_pool* pool) {
+  assert(pool);
+  size_t count = 0;
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    struct intern_shard* shard = &pool->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    count += shard->count;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return count;
+}
+
+static char* intern_copy_key(void* key_ctx, const char* key) {
+  return intern_pool_intern(key_ctx, key);
+}
+
+static void intern_free_key(void* key_ctx, char* key) {
+  intern_pool_release(key_ctx, key);
+}
+
+void hash_policy_intern(struct hash_policy* policy, struct intern_pool* pool) {
+  assert(policy);
+  assert(pool);
+  policy->copy_key = intern_copy_key;
+  policy->free_key = intern_free_key;
+  policy->key_ctx = pool;
+}
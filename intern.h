@@ -0,0 +1,69 @@
+/*
+ * This file contains the definition of an interface for a pool of interned
+ * keys: one shared, reference-counted copy of each distinct string.  Tables
+ * whose policies intern into the same pool store every key once between
+ * them, and the same key re-added after a reset or in another table reuses
+ * the copy already there.
+ */
+
+#ifndef __INTERN_H
+#define __INTERN_H
+
+#include <stddef.h>
+
+#include "hash_table.h"
+
+/*
+ * Structure used to represent an intern pool.
+ */
+struct intern_pool;
+
+/*
+ * Creates a new, empty intern pool.  A pool may be used from several threads
+ * at once; it is split into independently locked shards, so threads working
+ * on different keys seldom contend.
+ */
+struct intern_pool* intern_pool_create(void);
+
+/*
+ * Frees a pool and every key left in it.
+ *
+ * Params:
+ *   pool - the pool to be destroyed.  May not be NULL.  Tables using it must
+ *     have been freed first.
+ */
+void intern_pool_free(struct intern_pool* pool);
+
+/*
+ * Returns the pool's copy of key, adding the key if it is not there yet, and
+ * takes a reference to it.  Equal keys always get the same pointer.  Keys
+ * may be up to UINT32_MAX bytes long and may hold up to UINT32_MAX
+ * references each.
+ */
+char* intern_pool_intern(struct intern_pool* pool, const char* key);
+
+/*
+ * Drops a reference taken by intern_pool_intern().  The copy is freed with
+ * its last reference.
+ */
+void intern_pool_release(struct intern_pool* pool, char* key);
+
+/*
+ * Returns the pool's copy of key without taking a reference, or NULL if key
+ * is not in the pool.  Looking a key up in a table by its interned copy
+ * makes the key comparison a pointer comparison.
+ */
+const char* intern_pool_find(struct intern_pool* pool, const char* key);
+
+/*
+ * Returns the number of distinct keys in the pool.
+ */
+size_t intern_pool_size(struct intern_pool* pool);
+
+/*
+ * Makes policy store its keys in pool: sets its copy_key, free_key and
+ * key_ctx, leaving the hash and equal functions as they are.
+ */
+void hash_policy_intern(struct hash_policy* policy, struct intern_pool* pool);
+
+#endif
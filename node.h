@@ -1,15 +1,36 @@
 /*
  * This file contains the definition of a node structure for implementing
- * singly-linked lists that contain integer values.
+ * singly-linked lists of key/value pairs.  Each node also caches the hash
+ * code of its key so it never has to be recomputed.
+ *
+ * The value is stored inline at the end of the node, which is allocated with
+ * room for the table's value size: an int for tables created with
+ * hash_table_create(), or any fixed number of bytes for tables created with
+ * hash_table_create_config().
  */
 
 #ifndef __NODE_H
 #define __NODE_H
 
+#include <stdint.h>
+
+/*
+ * Element type of the inline value storage.  It only exists to give the
+ * storage the alignment of the most demanding basic types; "i" is the value
+ * of int-valued tables.
+ */
+union node_value {
+  int i;
+  long long ll;
+  double d;
+  void* p;
+};
+
 struct node {
   char* key;
-  int value;
   struct node* next;
+  uint64_t hash;
+  union node_value value[];
 };
 
 #endif
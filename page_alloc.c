@@ -0,0 +1,142 @@
+/*
+ * This file contains the definitions of functions allocating page-backed
+ * blocks with huge page and NUMA placement options.
+ */
+
+#define _DEFAULT_SOURCE  // for MAP_ANONYMOUS, madvise() and syscall()
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "page_alloc.h"
+
+/*
+ * Number of nodes covered by the node masks passed to the kernel.
+ */
+#define PAGE_MAX_NODES 1024
+
+#define PAGE_MASK_WORDS (PAGE_MAX_NODES / (8 * sizeof(unsigned long)))
+
+static size_t page_round(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+/*
+ * Applies a NUMA policy to a mapping that has not been touched yet.
+ */
+static void page_place(void* ptr, size_t len, enum page_numa numa) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy) && defined(SYS_getcpu)
+  const size_t word_bits = 8 * sizeof(unsigned long);
+  unsigned long nodemask[PAGE_MASK_WORDS];
+  int mode;
+  memset(nodemask, 0, sizeof(nodemask));
+  if (numa == PAGE_NUMA_INTERLEAVE) {
+    // Every node this process may allocate from.
+    if (syscall(SYS_get_mempolicy, NULL, nodemask, PAGE_MAX_NODES, NULL, MPOL_F_MEMS_ALLOWED) != 0) {
+      return;
+    }
+    mode = MPOL_INTERLEAVE;
+  } else if (numa == PAGE_NUMA_LOCAL) {
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= PAGE_MAX_NODES) {
+      return;
+    }
+    nodemask[node / word_bits] |= 1UL << (node % word_bits);
+    mode = MPOL_PREFERRED;
+  } else {
+    return;
+  }
+  // A failure leaves the default policy in place, which is still correct.
+  syscall(SYS_mbind, ptr, len, mode, nodemask, PAGE_MAX_NODES, 0);
+#else
+  (void) ptr;
+  (void) len;
+  (void) numa;
+#endif
+}
+
+/*
+ * Maps len bytes at an align-aligned address by over-mapping and trimming
+ * the excess; transparent huge pages only back aligned ranges.
+ */
+static void* page_map_aligned(size_t len, size_t align) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  size_t extra = align > page ? align : 0;
+  char* raw = mmap(NULL, len + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  char* start = (char*) page_round((uintptr_t) raw, extra > 0 ? align : page);
+  if (start > raw) {
+    munmap(raw, start - raw);
+  }
+  size_t tail = (size_t) (raw + len + extra - (start + len));
+  if (tail > 0) {
+    munmap(start + len, tail);
+  }
+  return start;
+}
+
+/*
+ * Allocates a block, mapping it directly when options ask for huge pages or
+ * NUMA placement.
+ */
+void* page_alloc(size_t size, const struct page_options* options, size_t* mapped) {
+  assert(mapped);
+  if (!page_options_set(options)) {
+    *mapped = 0;
+    return calloc(size > 0 ? size : 1, 1);
+  }
+
+  size_t align = options->huge != PAGE_HUGE_NONE ? PAGE_HUGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+  size_t len = page_round(size > 0 ? size : 1, align);
+  void* ptr = NULL;
+#if defined(__linux__) && defined(MAP_HUGETLB)
+  if (options->huge == PAGE_HUGE_EXPLICIT) {
+    ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED) {
+      ptr = NULL;
+    }
+  }
+#endif
+  if (ptr == NULL) {
+    ptr = page_map_aligned(len, align);
+    if (ptr == NULL) {
+      return NULL;
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (options->huge != PAGE_HUGE_NONE) {
+      madvise(ptr, len, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+  // Fresh anonymous pages read as zero, so nothing is touched here and the
+  // placement policy decides where each page lands on first use.
+  page_place(ptr, len, options->numa);
+  *mapped = len;
+  return ptr;
+}
+
+/*
+ * Unmaps or frees a block from page_alloc().
+ */
+void page_free(void* ptr, size_t mapped) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (mapped == 0) {
+    free(ptr);
+  } else {
+    munmap(ptr, mapped);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * This file contains the definition of an interface for allocating large,
+ * zero-filled blocks straight from the kernel, optionally backed by huge
+ * pages and placed on particular NUMA nodes.  It is used for bucket arrays
+ * and arena chunks, where TLB reach and memory placement matter.
+ */
+
+#ifndef __PAGE_ALLOC_H
+#define __PAGE_ALLOC_H
+
+#include <stddef.h>
+
+/*
+ * Size of the huge pages requested by PAGE_HUGE_TRANSPARENT and
+ * PAGE_HUGE_EXPLICIT.  Huge page blocks are rounded up to a multiple of it.
+ */
+#define PAGE_HUGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Whether a block should be backed by huge pages.
+ *
+ *   PAGE_HUGE_NONE        - normal pages
+ *   PAGE_HUGE_TRANSPARENT - ask for transparent huge pages (madvise), which
+ *                           the kernel may or may not provide
+ *   PAGE_HUGE_EXPLICIT    - take pages from the reserved hugetlbfs pool,
+ *                           falling back to PAGE_HUGE_TRANSPARENT when the
+ *                           pool is empty
+ */
+enum page_huge {
+  PAGE_HUGE_NONE,
+  PAGE_HUGE_TRANSPARENT,
+  PAGE_HUGE_EXPLICIT
+};
+
+/*
+ * Which NUMA nodes a block should be placed on.
+ *
+ *   PAGE_NUMA_DEFAULT    - the process policy (normally the node of the
+ *                          thread that first touches each page)
+ *   PAGE_NUMA_LOCAL      - the node of the thread allocating the block
+ *   PAGE_NUMA_INTERLEAVE - pages spread round-robin over all allowed nodes
+ *
+ * Placement is advisory: where NUMA policies are unsupported it is ignored.
+ */
+enum page_numa {
+  PAGE_NUMA_DEFAULT,
+  PAGE_NUMA_LOCAL,
+  PAGE_NUMA_INTERLEAVE
+};
+
+/*
+ * How a block is backed and placed.  A zero-initialized structure asks for
+ * nothing special.
+ */
+struct page_options {
+  enum page_huge huge;
+  enum page_numa numa;
+};
+
+/*
+ * Returns nonzero if options ask for huge pages or NUMA placement.
+ */
+static inline int page_options_set(const struct page_options* options) {
+  return options != NULL && (options->huge != PAGE_HUGE_NONE || options->numa != PAGE_NUMA_DEFAULT);
+}
+
+/*
+ * Allocates a zero-filled block of at least size bytes.  With options set,
+ * the block is mapped directly so that pages are only zeroed on first touch;
+ * otherwise it comes from calloc().
+ *
+ * Params:
+ *   size - the number of bytes needed
+ *   options - backing and placement, may be NULL
+ *   mapped - receives the length of the mapping, or 0 for calloc() blocks;
+ *            must be handed back to page_free()
+ *
+ * Return:
+ *   a pointer to the block, or NULL if no memory could be obtained
+ */
+void* page_alloc(size_t size, const struct page_options* options, size_t* mapped);
+
+/*
+ * Frees a block returned by page_alloc().
+ */
+void page_free(void* ptr, size_t mapped);
+
+#endif
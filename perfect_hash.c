@@ -0,0 +1,359 @@
+/*
+ * This file contains the definitions of structures and functions implementing
+ * minimal perfect hash tables.
+ *
+ * Construction follows the "hash and displace" scheme (CHD / PTHash): keys
+ * are first split into about n / PILOT_LOAD small buckets, then buckets are
+ * placed largest first.  For each bucket we search for a "pilot" value that
+ * sends all of its keys to slots that are still free; the pilots are all that
+ * a lookup needs besides the slots themselves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "node.h"
+#include "hash_table.h"
+#include "hash_table_internal.h"
+#include "perfect_hash.h"
+
+/*
+ * Average number of keys per pilot bucket.
+ */
+#define PILOT_LOAD 4
+
+/*
+ * Pilot values tried for one bucket before giving up on the current seed.
+ * The last buckets placed have only a few free slots left to hit: with k
+ * free slots out of n, a single key needs about n / k pilots.  The limit
+ * therefore grows with the number of keys, from MIN_PILOT_LIMIT up.
+ */
+#define MIN_PILOT_LIMIT (1u << 20)
+#define PILOT_LIMIT_FACTOR 16
+
+/*
+ * Seeds tried before concluding that the key set cannot be placed.
+ */
+#define MAX_ATTEMPTS 16
+
+/*
+ * A slot of the table: the key and value that hash to it.
+ */
+struct perfect_hash_slot {
+  const char* key;
+  int value;
+};
+
+/*
+ * Definition of the perfect_hash structure.
+ */
+struct perfect_hash {
+  uint64_t seed;
+  uint32_t total;
+  uint32_t num_buckets;
+  uint32_t* pilots;
+  struct perfect_hash_slot* slots;
+  char* keys;
+};
+
+static uint32_t perfect_hash_pilot_limit(uint32_t n) {
+  uint64_t limit = (uint64_t) n * PILOT_LIMIT_FACTOR;
+  if (limit < MIN_PILOT_LIMIT) {
+    return MIN_PILOT_LIMIT;
+  }
+  return limit > UINT32_MAX ? UINT32_MAX : (uint32_t) limit;
+}
+
+/*
+ * Tries to place every key with the given seed.  Fills in perfect_hash->pilots
+ * and slot_of (slot chosen for each key) and returns 1 on success.  Returns 0
+ * if some bucket could not be placed, and -1 if two keys are identical.
+ */
+static int perfect_hash_place(struct perfect_hash* perfect_hash, char** keys,
+                              uint64_t* hashes, uint32_t* slot_of) {
+  uint32_t n = perfect_hash->total;
+  uint32_t num_buckets = perfect_hash->num_buckets;
+
+  for (uint32_t i = 0; i < n; i++) {
+    hashes[i] = perfect_hash_key(keys[i], perfect_hash->seed);
+  }
+
+  // Group keys by bucket (counting sort): members[start[b] .. start[b + 1]).
+  uint32_t* start = calloc(num_buckets + 1, sizeof(uint32_t));
+  uint32_t* members = malloc(n * sizeof(uint32_t));
+  uint32_t* order = malloc(num_buckets * sizeof(uint32_t));
+  unsigned char* taken = calloc(n, 1);
+  assert(start && members && order && taken);
+
+  uint32_t max_size = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    start[perfect_hash_bucket(hashes[i], num_buckets) + 1]++;
+  }
+  for (uint32_t b = 0; b < num_buckets; b++) {
+    if (start[b + 1] > max_size) {
+      max_size = start[b + 1];
+    }
+    start[b + 1] += start[b];
+  }
+  uint32_t* fill = malloc(num_buckets * sizeof(uint32_t));
+  assert(fill);
+  memcpy(fill, start, num_buckets * sizeof(uint32_t));
+  for (uint32_t i = 0; i < n; i++) {
+    members[fill[perfect_hash_bucket(hashes[i], num_buckets)]++] = i;
+  }
+
+  // Order buckets largest first (counting sort on bucket size).
+  uint32_t* by_size = calloc(max_size + 2, sizeof(uint32_t));
+  assert(by_size);
+  for (uint32_t b = 0; b < num_buckets; b++) {
+    by_size[max_size - (start[b + 1] - start[b]) + 1]++;
+  }
+  for (uint32_t k = 0; k <= max_size; k++) {
+    by_size[k + 1] += by_size[k];
+  }
+  for (uint32_t b = 0; b < num_buckets; b++) {
+    order[by_size[max_size - (start[b + 1] - start[b])]++] = b;
+  }
+  free(by_size);
+
+  uint32_t pilot_limit = perfect_hash_pilot_limit(n);
+  int result = 1;
+  for (uint32_t k = 0; k < num_buckets && result == 1; k++) {
+    uint32_t b = order[k];
+    uint32_t first = start[b];
+    uint32_t last = start[b + 1];
+    perfect_hash->pilots[b] = 0;
+    if (first == last) {
+      continue;
+    }
+
+    // Keys with equal hashes can never be separated by a pilot.
+    for (uint32_t i = first; i < last && result == 1; i++) {
+      for (uint32_t j = i + 1; j < last; j++) {
+        if (hashes[members[i]] == hashes[members[j]]) {
+          result = strcmp(keys[members[i]], keys[members[j]]) == 0 ? -1 : 0;
+          break;
+        }
+      }
+    }
+    if (result != 1) {
+      break;
+    }
+
+    uint32_t pilot;
+    for (pilot = 0; pilot < pilot_limit; pilot++) {
+      uint32_t i;
+      for (i = first; i < last; i++) {
+        uint32_t slot = perfect_hash_slot(hashes[members[i]], pilot, n);
+        if (taken[slot]) {
+          break;
+        }
+        taken[slot] = 1;
+        slot_of[members[i]] = slot;
+      }
+      if (i == last) {
+        break;
+      }
+      // Undo the partial placement and try the next pilot.
+      while (i-- > first) {
+        taken[slot_of[members[i]]] = 0;
+      }
+    }
+    if (pilot == pilot_limit) {
+      result = 0;
+    }
+    perfect_hash->pilots[b] = pilot;
+  }
+
+  free(start);
+  free(members);
+  free(order);
+  free(taken);
+  free(fill);
+  return result;
+}
+
+/*
+ * Builds a minimal perfect hash table over n distinct keys.
+ */
+struct perfect_hash* perfect_hash_build(char** keys, int* values, size_t n) {
+  assert(n == 0 || (keys && values));
+  if (n > UINT32_MAX) {
+    return NULL;
+  }
+
+  struct perfect_hash* perfect_hash = malloc(sizeof(struct perfect_hash));
+  assert(perfect_hash);
+  perfect_hash->total = (uint32_t) n;
+  perfect_hash->num_buckets = (uint32_t) n / PILOT_LOAD + 1;
+  perfect_hash->pilots = calloc(perfect_hash->num_buckets, sizeof(uint32_t));
+  perfect_hash->slots = calloc(n > 0 ? n : 1, sizeof(struct perfect_hash_slot));
+  assert(perfect_hash->pilots && perfect_hash->slots);
+
+  uint64_t* hashes = malloc((n > 0 ? n : 1) * sizeof(uint64_t));
+  uint32_t* slot_of = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  assert(hashes && slot_of);
+
+  int placed = 0;
+  for (int attempt = 0; attempt < MAX_ATTEMPTS && placed == 0; attempt++) {
+    perfect_hash->seed = perfect_hash_mix((uint64_t) attempt + 1);
+    placed = perfect_hash_place(perfect_hash, keys, hashes, slot_of);
+  }
+  free(hashes);
+  if (placed != 1) {
+    free(slot_of);
+    free(perfect_hash->pilots);
+    free(perfect_hash->slots);
+    free(perfect_hash);
+    return NULL;
+  }
+
+  // Copy the keys into one blob and fill in the slots.
+  size_t key_bytes = 0;
+  for (size_t i = 0; i < n; i++) {
+    key_bytes += strlen(keys[i]) + 1;
+  }
+  perfect_hash->keys = malloc(key_bytes > 0 ? key_bytes : 1);
+  assert(perfect_hash->keys);
+  char* key = perfect_hash->keys;
+  for (size_t i = 0; i < n; i++) {
+    size_t len = strlen(keys[i]) + 1;
+    memcpy(key, keys[i], len);
+    perfect_hash->slots[slot_of[i]].key = key;
+    perfect_hash->slots[slot_of[i]].value = values[i];
+    key += len;
+  }
+  free(slot_of);
+  return perfect_hash;
+}
+
+static int compare_keys(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Sorts a copy of the key array and looks for equal neighbours.
+ */
+const char* perfect_hash_find_duplicate(char** keys, size_t n) {
+  assert(n == 0 || keys);
+  if (n < 2) {
+    return NULL;
+  }
+  char** sorted = malloc(n * sizeof(char*));
+  assert(sorted);
+  memcpy(sorted, keys, n * sizeof(char*));
+  qsort(sorted, n, sizeof(char*), compare_keys);
+  const char* duplicate = NULL;
+  for (size_t i = 1; i < n && duplicate == NULL; i++) {
+    if (strcmp(sorted[i - 1], sorted[i]) == 0) {
+      duplicate = sorted[i];
+    }
+  }
+  free(sorted);
+  return duplicate;
+}
+
+/*
+ * Collects the elements of a hash_table and builds a perfect hash over them.
+ */
+struct perfect_hash* perfect_hash_from_table(struct hash_table* hash_table) {
+  assert(hash_table);
+  assert(hash_table->int_values);
+  if (hash_table->total > UINT32_MAX) {
+    return NULL;
+  }
+  size_t n = hash_table->total;
+  char** keys = malloc((n > 0 ? n : 1) * sizeof(char*));
+  int* values = malloc((n > 0 ? n : 1) * sizeof(int));
+  assert(keys && values);
+
+  size_t count = 0;
+  struct hash_table_iter iter;
+  const char* key;
+  void* value;
+  hash_table_iter_begin(hash_table, &iter);
+  while (hash_table_iter_next(&iter, &key, &value)) {
+    assert(count < n);
+    keys[count] = (char*) key;
+    values[count] = *(int*) value;
+    count++;
+  }
+  struct perfect_hash* perfect_hash = perfect_hash_build(keys, values, count);
+  free(keys);
+  free(values);
+  return perfect_hash;
+}
+
+/*
+ * Frees all the memory associated with the perfect hash table.
+ */
+void perfect_hash_free(struct perfect_hash* perfect_hash) {
+  assert(perfect_hash);
+  free(perfect_hash->pilots);
+  free(perfect_hash->slots);
+  free(perfect_hash->keys);
+  free(perfect_hash);
+}
+
+/*
+ * Looks up key: one pilot, one slot, one key comparison.
+ */
+int perfect_hash_get(struct perfect_hash* perfect_hash, char* key, int* value) {
+  assert(perfect_hash);
+  if (perfect_hash->total == 0) {
+    return 0;
+  }
+  uint64_t h = perfect_hash_key(key, perfect_hash->seed);
+  uint32_t pilot = perfect_hash->pilots[perfect_hash_bucket(h, perfect_hash->num_buckets)];
+  struct perfect_hash_slot* slot = &perfect_hash->slots[perfect_hash_slot(h, pilot, perfect_hash->total)];
+  if (strcmp(slot->key, key) != 0) {
+    return 0;
+  }
+  if (value != NULL) {
+    *value = slot->value;
+  }
+  return 1;
+}
+
+/*
+ * Every key owns exactly one slot, so there is never a collision.
+ */
+size_t perfect_hash_collisions(struct perfect_hash* perfect_hash) {
+  assert(perfect_hash);
+  return 0;
+}
+
+uint64_t perfect_hash_seed(struct perfect_hash* perfect_hash) {
+  assert(perfect_hash);
+  return perfect_hash->seed;
+}
+
+size_t perfect_hash_total(struct perfect_hash* perfect_hash) {
+  assert(perfect_hash);
+  return perfect_hash->total;
+}
+
+size_t perfect_hash_num_buckets(struct perfect_hash* perfect_hash) {
+  assert(perfect_hash);
+  return perfect_hash->num_buckets;
+}
+
+uint32_t perfect_hash_pilot(struct perfect_hash* perfect_hash, size_t bucket) {
+  assert(perfect_hash);
+  assert(bucket < perfect_hash->num_buckets);
+  return perfect_hash->pilots[bucket];
+}
+
+const char* perfect_hash_slot_key(struct perfect_hash* perfect_hash, size_t slot) {
+  assert(perfect_hash);
+  assert(slot < perfect_hash->total);
+  return perfect_hash->slots[slot].key;
+}
+
+int perfect_hash_slot_value(struct perfect_hash* perfect_hash, size_t slot) {
+  assert(perfect_hash);
+  assert(slot < perfect_hash->total);
+  return perfect_hash->slots[slot].value;
+}
@@ -0,0 +1,133 @@
+/*
+ * This file contains the definition of an interface for minimal perfect hash
+ * tables built from a static set of keys.  Every key gets a slot of its own,
+ * so there are no collisions and a lookup is one bucket "pilot" read plus one
+ * slot read, no matter how the keys are distributed.
+ */
+
+#ifndef __PERFECT_HASH_H
+#define __PERFECT_HASH_H
+
+#include <stdint.h>
+
+#include "hash_table.h"
+
+/*
+ * Structure used to represent a perfect hash table.
+ */
+struct perfect_hash;
+
+/*
+ * The key hash shared by perfect_hash.c and the tables generated from it.
+ * A seeded FNV-1a pass over the key followed by a 64-bit finalizer.
+ */
+static inline uint64_t perfect_hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t perfect_hash_key(const char* key, uint64_t seed) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+  while (*key) {
+    h ^= (unsigned char) *key++;
+    h *= 0x100000001b3ULL;
+  }
+  return perfect_hash_mix(h);
+}
+
+/*
+ * Maps a key hash to its pilot bucket and, given that bucket's pilot, to its
+ * slot.  The bucket uses a multiply-shift instead of a division.
+ */
+static inline uint32_t perfect_hash_bucket(uint64_t h, uint32_t num_buckets) {
+  return (uint32_t) (((h >> 32) * (uint64_t) num_buckets) >> 32);
+}
+
+static inline uint64_t perfect_hash_displace(uint32_t pilot) {
+  return perfect_hash_mix(pilot + 0x9e3779b97f4a7c15ULL);
+}
+
+static inline uint32_t perfect_hash_slot(uint64_t h, uint32_t pilot, uint32_t num_keys) {
+  return (uint32_t) ((h ^ perfect_hash_displace(pilot)) % num_keys);
+}
+
+/*
+ * Builds a minimal perfect hash table over n distinct keys.  Slots and pilot
+ * buckets are numbered with 32 bits, as in the generated tables, so a table
+ * holds at most UINT32_MAX keys.
+ *
+ * Params:
+ *   keys - the keys; they are copied, so the array may be freed afterwards
+ *   values - the value for each key
+ *   n - the number of keys
+ *
+ * Return:
+ *   returns the new table, or NULL if there are more than UINT32_MAX keys,
+ *   or the keys contain duplicates or could not be placed (which takes keys
+ *   whose 64-bit hashes collide under every seed tried, and is not expected
+ *   to happen); perfect_hash_find_duplicate() tells the last two apart
+ */
+struct perfect_hash* perfect_hash_build(char** keys, int* values, size_t n);
+
+/*
+ * Looks for a key that occurs more than once among n keys.
+ *
+ * Return:
+ *   returns one of the repeated keys, or NULL if all n keys are distinct
+ */
+const char* perfect_hash_find_duplicate(char** keys, size_t n);
+
+/*
+ * Builds a minimal perfect hash table holding every element of a hash table,
+ * which must hold int values.
+ *
+ * Return:
+ *   returns the new table, or NULL if the hash table holds duplicate keys or
+ *   more than UINT32_MAX elements, or its keys could not be placed
+ */
+struct perfect_hash* perfect_hash_from_table(struct hash_table* hash_table);
+
+/*
+ * Free all of the memory associated with a perfect hash table.
+ *
+ * Params:
+ *   perfect_hash - the table to be destroyed.  May not be NULL.
+ */
+void perfect_hash_free(struct perfect_hash* perfect_hash);
+
+/*
+ * Looks up the value stored under a key, like hash_table_get().
+ *
+ * Params:
+ *   perfect_hash - the table to search.  May not be NULL.
+ *   key - the key to look for
+ *   value - receives the value if the key is found.  May be NULL.
+ *
+ * Return:
+ *   returns 1 if the key was found, 0 otherwise
+ */
+int perfect_hash_get(struct perfect_hash* perfect_hash, char* key, int* value);
+
+/*
+ * Counts collisions the same way hash_table_collisions() does.  Every key has
+ * a slot of its own, so this is always 0.
+ */
+size_t perfect_hash_collisions(struct perfect_hash* perfect_hash);
+
+/*
+ * Read-only access to a built table, used by the table generator (phgen):
+ * the seed, the number of keys (and slots), the number of pilot buckets, the
+ * pilot of each bucket, and the key and value stored in each slot.
+ */
+uint64_t perfect_hash_seed(struct perfect_hash* perfect_hash);
+size_t perfect_hash_total(struct perfect_hash* perfect_hash);
+size_t perfect_hash_num_buckets(struct perfect_hash* perfect_hash);
+uint32_t perfect_hash_pilot(struct perfect_hash* perfect_hash, size_t bucket);
+const char* perfect_hash_slot_key(struct perfect_hash* perfect_hash, size_t slot);
+int perfect_hash_slot_value(struct perfect_hash* perfect_hash, size_t slot);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+ * This file contains a generator for compile-time perfect hash tables.
+ *
+ * Usage: phgen NAME KEYFILE > NAME_phash.h
+ *
+ * KEYFILE holds one "key value" pair per line, with a decimal value that fits
+ * in an int (blank lines and lines starting with '#' are ignored).  The output is a self-contained header with the
+ * pilots and slots as constant arrays and a static inline NAME_get() lookup
+ * with the seed, bucket count and slot count folded in as constants, so using
+ * the table needs no construction, no malloc and no function call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "perfect_hash.h"
+
+#define MAX_LINE 4096
+
+/*
+ * Returns 1 if name can be used as a C identifier.
+ */
+static int is_identifier(const char* name) {
+  if (!isalpha((unsigned char) name[0]) && name[0] != '_') {
+    return 0;
+  }
+  for (; *name; name++) {
+    if (!isalnum((unsigned char) *name) && *name != '_') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Writes key as a C string literal.
+ */
+static void print_c_string(const char* key) {
+  putchar('"');
+  for (; *key; key++) {
+    unsigned char c = (unsigned char) *key;
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (isprint(c)) {
+      putchar(c);
+    } else {
+      printf("\\%03o", c);
+    }
+  }
+  putchar('"');
+}
+
+/*
+ * Reads the key file into growing key and value arrays and stores the number
+ * of pairs read in *n_out.  Returns 1, or 0 after reporting a malformed line.
+ */
+static int read_keys(FILE* in, const char* path, char*** keys_out, int** values_out, size_t* n_out) {
+  char line[MAX_LINE];
+  size_t capacity = 64;
+  size_t n = 0;
+  char** keys = malloc(capacity * sizeof(char*));
+  int* values = malloc(capacity * sizeof(int));
+  assert(keys && values);
+
+  for (int line_no = 1; fgets(line, sizeof(line), in) != NULL; line_no++) {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      fprintf(stderr, "%s:%d: line too long\n", path, line_no);
+      return 0;
+    }
+    char* key = strtok(line, " \t\r\n");
+    if (key == NULL || key[0] == '#') {
+      continue;
+    }
+    char* value = strtok(NULL, " \t\r\n");
+    char* end = NULL;
+    long parsed = 0;
+    if (value != NULL) {
+      errno = 0;
+      parsed = strtol(value, &end, 10);
+    }
+    if (value == NULL || end == value || *end != '\0' || strtok(NULL, " \t\r\n") != NULL) {
+      fprintf(stderr, "%s:%d: expected \"key value\"\n", path, line_no);
+      return 0;
+    }
+    if (errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX) {
+      fprintf(stderr, "%s:%d: value %s out of range\n", path, line_no, value);
+      return 0;
+    }
+
+    if (n == capacity) {
+      capacity *= 2;
+      keys = realloc(keys, capacity * sizeof(char*));
+      values = realloc(values, capacity * sizeof(int));
+      assert(keys && values);
+    }
+    keys[n] = malloc(strlen(key) + 1);
+    assert(keys[n]);
+    strcpy(keys[n], key);
+    values[n] = (int) parsed;
+    n++;
+  }
+
+  *keys_out = keys;
+  *values_out = values;
+  *n_out = n;
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3 || !is_identifier(argv[1])) {
+    fprintf(stderr, "usage: %s NAME KEYFILE > NAME_phash.h\n", argv[0]);
+    return 2;
+  }
+  const char* name = argv[1];
+  const char* path = argv[2];
+
+  FILE* in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  char** keys;
+  int* values;
+  size_t n;
+  int ok = read_keys(in, path, &keys, &values, &n);
+  fclose(in);
+  if (!ok) {
+    return 1;
+  }
+  if (n == 0) {
+    fprintf(stderr, "%s: no keys\n", path);
+    return 1;
+  }
+
+  struct perfect_hash* perfect_hash = perfect_hash_build(keys, values, n);
+  if (perfect_hash == NULL) {
+    const char* duplicate = perfect_hash_find_duplicate(keys, n);
+    if (duplicate != NULL) {
+      fprintf(stderr, "%s: duplicate key \"%s\"\n", path, duplicate);
+    } else {
+      fprintf(stderr, "%s: could not place the keys\n", path);
+    }
+    return 1;
+  }
+  size_t num_buckets = perfect_hash_num_buckets(perfect_hash);
+
+  char upper[256];
+  snprintf(upper, sizeof(upper), "%s", name);
+  for (char* p = upper; *p; p++) {
+    *p = (char) toupper((unsigned char) *p);
+  }
+
+  printf("/*\n * Generated by phgen from %s.  Do not edit.\n", path);
+  printf(" *\n * Perfect hash table of %zu keys: %s_get() looks a key up with one\n", n, name);
+  printf(" * displacement read and one slot read.\n */\n\n");
+  printf("#ifndef __%s_PHASH_H\n#define __%s_PHASH_H\n\n", upper, upper);
+  printf("#include <stdint.h>\n#include <string.h>\n\n#include \"perfect_hash.h\"\n\n");
+  printf("#define %s_TOTAL %zu\n\n", upper, n);
+
+  // Each pilot is stored already mixed, exactly as perfect_hash_slot() uses it.
+  printf("static const uint64_t %s_displace[%zu] = {\n", name, num_buckets);
+  for (size_t b = 0; b < num_buckets; b++) {
+    uint64_t displace = perfect_hash_displace(perfect_hash_pilot(perfect_hash, b));
+    printf("  0x%016" PRIx64 "ULL,\n", displace);
+  }
+  printf("};\n\n");
+
+  printf("static const struct {\n  const char* key;\n  int value;\n} %s_slots[%zu] = {\n", name, n);
+  for (size_t i = 0; i < n; i++) {
+    printf("  { ");
+    print_c_string(perfect_hash_slot_key(perfect_hash, i));
+    printf(", %d },\n", perfect_hash_slot_value(perfect_hash, i));
+  }
+  printf("};\n\n");
+
+  printf("/*\n * Looks up key.  Returns 1 and stores its value in *value (if not NULL)\n");
+  printf(" * when the key is in the table, 0 otherwise.\n */\n");
+  printf("static inline int %s_get(const char* key, int* value) {\n", name);
+  printf("  uint64_t h = perfect_hash_key(key, 0x%016" PRIx64 "ULL);\n", perfect_hash_seed(perfect_hash));
+  printf("  uint64_t displace = %s_displace[perfect_hash_bucket(h, %zuu)];\n", name, num_buckets);
+  printf("  uint32_t slot = (uint32_t) ((h ^ displace) %% %zuu);\n", n);
+  printf("  if (strcmp(%s_slots[slot].key, key) != 0) {\n    return 0;\n  }\n", name);
+  printf("  if (value != NULL) {\n    *value = %s_slots[slot].value;\n  }\n", name);
+  printf("  return 1;\n}\n\n");
+  printf("#endif\n");
+
+  perfect_hash_free(perfect_hash);
+  for (size_t i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+  free(values);
+  return ferror(stdout) ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * This file contains the definitions of functions implementing SipHash.
+ */
+
+#define _DEFAULT_SOURCE  // for syscall()
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "siphash.h"
+
+#define SIPHASH_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3) \
+  do { \
+    v0 += v1; v1 = SIPHASH_ROTL(v1, 13); v1 ^= v0; v0 = SIPHASH_ROTL(v0, 32); \
+    v2 += v3; v3 = SIPHASH_ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = SIPHASH_ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = SIPHASH_ROTL(v1, 17); v1 ^= v2; v2 = SIPHASH_ROTL(v2, 32); \
+  } while (0)
+
+/*
+ * Reads n (at most 8) bytes as a little-endian word, whatever the byte order
+ * and alignment of the machine.
+ */
+static uint64_t siphash_load(const unsigned char* p, size_t n) {
+  uint64_t word = 0;
+  for (size_t i = 0; i < n; i++) {
+    word |= (uint64_t) p[i] << (8 * i);
+  }
+  return word;
+}
+
+uint64_t siphash(const uint64_t key[2], const void* data, size_t len) {
+  const unsigned char* in = data;
+  uint64_t v0 = key[0] ^ UINT64_C(0x736f6d6570736575);
+  uint64_t v1 = key[1] ^ UINT64_C(0x646f72616e646f6d);
+  uint64_t v2 = key[0] ^ UINT64_C(0x6c7967656e657261);
+  uint64_t v3 = key[1] ^ UINT64_C(0x7465646279746573);
+
+  const unsigned char* end = in + (len & ~(size_t) 7);
+  for (; in != end; in += 8) {
+    uint64_t m = siphash_load(in, 8);
+    v3 ^= m;
+    for (int i = 0; i < SIPHASH_C_ROUNDS; i++) {
+      SIPHASH_ROUND(v0, v1, v2, v3);
+    }
+    v0 ^= m;
+  }
+
+  // The last word holds the remaining bytes and the length in its top byte.
+  uint64_t m = siphash_load(in, len & 7) | (uint64_t) len << 56;
+  v3 ^= m;
+  for (int i = 0; i < SIPHASH_C_ROUNDS; i++) {
+    SIPHASH_ROUND(v0, v1, v2, v3);
+  }
+  v0 ^= m;
+
+  v2 ^= 0xff;
+  for (int i = 0; i < SIPHASH_D_ROUNDS; i++) {
+    SIPHASH_ROUND(v0, v1, v2, v3);
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+void siphash_random_key(uint64_t key[2]) {
+#if defined(__linux__) && defined(SYS_getrandom)
+  if (syscall(SYS_getrandom, key, 2 * sizeof(uint64_t), 0) == (long) (2 * sizeof(uint64_t))) {
+    return;
+  }
+#endif
+  FILE* random = fopen("/dev/urandom", "rb");
+  if (random != NULL) {
+    size_t got = fread(key, sizeof(uint64_t), 2, random);
+    fclose(random);
+    if (got == 2) {
+      return;
+    }
+  }
+
+  // Last resort: nothing an outside attacker can read directly, hashed so
+  // that every bit of the inputs affects both words.
+  static uint64_t counter;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t seed[2] = { (uint64_t) now.tv_sec ^ (uint64_t) (uintptr_t) &now,
+                       (uint64_t) now.tv_nsec ^ (uint64_t) getpid() << 32 ^ ++counter };
+  key[0] = siphash(seed, &counter, sizeof(counter));
+  key[1] = siphash(seed, key, sizeof(uint64_t));
+}
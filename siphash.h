@@ -0,0 +1,31 @@
+/*
+ * This file contains the definition of an interface for SipHash, a keyed
+ * hash function.  Without the key, an attacker cannot predict which inputs
+ * collide, so tables hashed with it cannot be flooded with colliding keys.
+ */
+
+#ifndef __SIPHASH_H
+#define __SIPHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Number of compression and finalization rounds.  SipHash-1-3 is the
+ * variant hash tables commonly use; the reference SipHash-2-4 needs 2 and 4.
+ */
+#define SIPHASH_C_ROUNDS 1
+#define SIPHASH_D_ROUNDS 3
+
+/*
+ * Returns the SipHash of len bytes at data under the 128-bit key.
+ */
+uint64_t siphash(const uint64_t key[2], const void* data, size_t len);
+
+/*
+ * Fills key with random bits from the operating system, or, where none are
+ * available, with bits derived from the time and addresses of the process.
+ */
+void siphash_random_key(uint64_t key[2]);
+
+#endif
@@ -2,12 +2,39 @@
  * This file contains executable code for testing your work in this assignment.
  */
 
+#define _POSIX_C_SOURCE 200809L  // for fileno()
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "node.h"
 #include "hash_table.h"
+#include "hash_table_internal.h"
+#include "hash_batch.h"
+#include "typed_hash_table.h"
+#include "frozen_table.h"
+#include "intern.h"
+#include "hash_table_parallel.h"
+#include "page_alloc.h"
+#include "perfect_hash.h"
+#include "products_phash.h"
+
+/*
+ * Like assert(), but never compiled out: many checks wrap the very call they
+ * check (a save, a remove, a build), which must still run under NDEBUG.
+ */
+#define CHECK(condition)                                                      \
+  do {                                                                        \
+    if (!(condition)) {                                                       \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,       \
+              #condition);                                                    \
+      abort();                                                                \
+    }                                                                         \
+  } while (0)
  
 
 int NUM_TESTING_PRODUCTS = 11;
@@ -48,17 +75,1386 @@ int TEST_INVENTORIES[] = {
   7
 };
 
+/*
+ * Hashes a key to its length, so that tests know which bucket it lands in.
+ */
+static size_t test_hash_length(struct hash_table* hash_table, char* key) {
+  return strlen(key) % hash_table->size;
+}
+
+/*
+ * Dump sink collecting the output in a fixed buffer.
+ */
+struct test_sink {
+  char data[4096];
+  size_t len;
+};
+
+static size_t test_sink_write(void* ctx, const char* buf, size_t len) {
+  struct test_sink* sink = ctx;
+  CHECK(sink->len + len < sizeof(sink->data));
+  memcpy(sink->data + sink->len, buf, len);
+  sink->len += len;
+  sink->data[sink->len] = '\0';
+  return len;
+}
+
+/*
+ * Checks the dump formats, and that a dump to a file descriptor writes the
+ * same bytes as one to a sink.
+ */
+static void test_dump(void) {
+  struct hash_policy policy = { 0 };
+  policy.hash = test_hash_length;
+  struct hash_table_config config = { 0 };
+  config.array_size = 4;
+  config.policy = &policy;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  hash_table_add(hash_table, "a", 1);
+  hash_table_add(hash_table, "b,\"", -2);
+
+  struct hash_table_dump_options options = { 0 };
+  struct test_sink sink;
+  options.format = HASH_TABLE_DUMP_COMPACT;
+  sink.len = 0;
+  CHECK(hash_table_dump(hash_table, &options, test_sink_write, &sink));
+  CHECK(strcmp(sink.data, "1\ta\t1\n3\tb,\"\t-2\n") == 0);
+
+  options.format = HASH_TABLE_DUMP_CSV;
+  sink.len = 0;
+  CHECK(hash_table_dump(hash_table, &options, test_sink_write, &sink));
+  CHECK(strcmp(sink.data, "bucket,key,value\n1,a,1\n3,\"b,\"\"\",-2\n") == 0);
+
+  options.format = HASH_TABLE_DUMP_JSON;
+  options.first_bucket = 2;
+  sink.len = 0;
+  CHECK(hash_table_dump(hash_table, &options, test_sink_write, &sink));
+  CHECK(strcmp(sink.data, "{\"size\":4,\"total\":2,\"entries\":[\n"
+                           "  {\"bucket\":3,\"key\":\"b,\\\"\",\"value\":-2}\n]}\n") == 0);
+
+  options.format = HASH_TABLE_DUMP_DISPLAY;
+  options.first_bucket = 0;
+  options.max_entries = 1;
+  sink.len = 0;
+  CHECK(hash_table_dump(hash_table, &options, test_sink_write, &sink));
+  CHECK(strcmp(sink.data, "Hash table, size=4, total=2\n"
+                           "array[0]-|\narray[1]->(key=a,value=1)-|\n\n") == 0);
+
+  FILE* file = tmpfile();
+  CHECK(file);
+  CHECK(hash_table_dump_fd(hash_table, &options, fileno(file)));
+  char data[sizeof(sink.data)];
+  rewind(file);
+  CHECK(fread(data, 1, sizeof(data), file) == sink.len);
+  CHECK(memcmp(data, sink.data, sink.len) == 0);
+  fclose(file);
+
+  hash_table_free(hash_table);
+}
+
+/*
+ * Saves hash_table to a temporary file and loads it back.
+ */
+static struct hash_table* test_round_trip(struct hash_table* hash_table, char* path) {
+  CHECK(hash_table_save(hash_table, path));
+  struct hash_table* loaded = hash_table_load(path, NULL);
+  CHECK(loaded);
+  CHECK(loaded->size == hash_table->size);
+  CHECK(loaded->total == hash_table->total);
+  return loaded;
+}
+
+/*
+ * Checks that snapshots keep int values, inline values and empty tables, and
+ * that a header claiming an oversized value is rejected.
+ */
+static void test_snapshot(void) {
+  char path[] = "/tmp/hash_table_test_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+
+  struct hash_table* hash_table = hash_table_create(8);
+  struct hash_table* loaded = test_round_trip(hash_table, path);
+  CHECK(!hash_table_get(loaded, "apples", NULL));
+  hash_table_free(loaded);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
+  }
+  loaded = test_round_trip(hash_table, path);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    int inventory;
+    CHECK(hash_table_get(loaded, TEST_NAMES[i], &inventory));
+    CHECK(inventory == TEST_INVENTORIES[i]);
+  }
+  CHECK(!hash_table_get(loaded, "bananas", NULL));
+  hash_table_free(loaded);
+  hash_table_free(hash_table);
+
+  struct hash_table_config config = { 0 };
+  config.array_size = 5;
+  config.value_size = 3 * sizeof(double);
+  hash_table = hash_table_create_config(&config);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    double value[3] = { i, i * 0.5, -i };
+    hash_table_add_value(hash_table, TEST_NAMES[i], value);
+  }
+  loaded = test_round_trip(hash_table, path);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    double* value = hash_table_lookup(loaded, TEST_NAMES[i]);
+    CHECK(value && value[0] == i && value[1] == i * 0.5 && value[2] == -i);
+  }
+  hash_table_free(loaded);
+  hash_table_free(hash_table);
+
+  // value_size follows the magic and the byte order mark.
+  FILE* file = fopen(path, "r+b");
+  CHECK(file);
+  uint32_t value_size = 0xffffffffu;
+  CHECK(fseek(file, 12, SEEK_SET) == 0 && fwrite(&value_size, sizeof(value_size), 1, file) == 1);
+  fclose(file);
+  CHECK(hash_table_load(path, NULL) == NULL);
+  unlink(path);
+}
+
+/*
+ * Offsets of the total and key_bytes header fields of a frozen table file,
+ * and the sizes of its header and of one of its entries (see frozen_table.c).
+ */
+#define TEST_FROZEN_HEADER_SIZE 56
+#define TEST_FROZEN_TOTAL 16
+#define TEST_FROZEN_KEY_BYTES 32
+#define TEST_FROZEN_ENTRY_SIZE 24
+
+/*
+ * Reads (write == 0) or overwrites (write != 0) size bytes of a file at
+ * offset.
+ */
+static void test_patch(const char* path, long offset, void* data, size_t size, int write) {
+  FILE* file = fopen(path, "r+b");
+  CHECK(file);
+  CHECK(fseek(file, offset, SEEK_SET) == 0);
+  size_t done = write ? fwrite(data, 1, size, file) : fread(data, 1, size, file);
+  CHECK(done == size);
+  fclose(file);
+}
+
+/*
+ * Checks that a frozen table answers like the table it was frozen from, and
+ * that damaged files are rejected: one cut short, one whose section sizes
+ * only add up to the file size by wrapping around, and one whose last key
+ * lost its NUL.
+ */
+static void test_frozen(void) {
+  char path[] = "/tmp/hash_table_test_XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+
+  struct hash_table* hash_table = hash_table_create(8);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
+  }
+  CHECK(hash_table_freeze(hash_table, path));
+  hash_table_free(hash_table);
+
+  struct frozen_table* frozen_table = frozen_table_open(path, NULL);
+  CHECK(frozen_table);
+  CHECK(frozen_table_size(frozen_table) == 8);
+  CHECK(frozen_table_total(frozen_table) == (size_t) NUM_TESTING_PRODUCTS);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    int inventory;
+    CHECK(frozen_table_get(frozen_table, TEST_NAMES[i], &inventory));
+    CHECK(inventory == TEST_INVENTORIES[i]);
+  }
+  CHECK(!frozen_table_get(frozen_table, "bananas", NULL));
+  CHECK(!frozen_table_get(frozen_table, "", NULL));
+  frozen_table_close(frozen_table);
+
+  // A file cut short inside its entries.
+  CHECK(truncate(path, TEST_FROZEN_HEADER_SIZE + 10) == 0);
+  CHECK(frozen_table_open(path, NULL) == NULL);
+
+  // total raised by 2^27 entries and key_bytes lowered by as many bytes, so
+  // that the section sizes still add up to the file size modulo 2^64.
+  hash_table = hash_table_create(8);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
+  }
+  CHECK(hash_table_freeze(hash_table, path));
+  hash_table_free(hash_table);
+  uint32_t total;
+  uint64_t key_bytes;
+  test_patch(path, TEST_FROZEN_TOTAL, &total, sizeof(total), 0);
+  test_patch(path, TEST_FROZEN_KEY_BYTES, &key_bytes, sizeof(key_bytes), 0);
+  total += (uint32_t) 1 << 27;
+  key_bytes -= ((uint64_t) 1 << 27) * TEST_FROZEN_ENTRY_SIZE;
+  test_patch(path, TEST_FROZEN_TOTAL, &total, sizeof(total), 1);
+  test_patch(path, TEST_FROZEN_KEY_BYTES, &key_bytes, sizeof(key_bytes), 1);
+  CHECK(frozen_table_open(path, NULL) == NULL);
+
+  FILE* file = fopen(path, "r+b");
+  CHECK(file);
+  CHECK(fseek(file, -1, SEEK_END) == 0 && fputc('x', file) == 'x');
+  fclose(file);
+  CHECK(frozen_table_open(path, NULL) == NULL);
+  unlink(path);
+}
+
+/*
+ * Checks that duplicate keys are reported apart from placement, and that a
+ * larger key set is placed.
+ */
+static void test_perfect_hash(void) {
+  CHECK(perfect_hash_find_duplicate(TEST_NAMES, NUM_TESTING_PRODUCTS) == NULL);
+  char* keys[] = { "soup", "milk", "tofu", "milk" };
+  int values[] = { 1, 2, 3, 4 };
+  CHECK(perfect_hash_build(keys, values, 4) == NULL);
+  CHECK(strcmp(perfect_hash_find_duplicate(keys, 4), "milk") == 0);
+
+  int n = 50000;
+  char** many = malloc(n * sizeof(char*));
+  int* many_values = malloc(n * sizeof(int));
+  CHECK(many && many_values);
+  for (int i = 0; i < n; i++) {
+    many[i] = malloc(16);
+    CHECK(many[i]);
+    snprintf(many[i], 16, "k%d", i);
+    many_values[i] = i;
+  }
+  struct perfect_hash* perfect_hash = perfect_hash_build(many, many_values, n);
+  CHECK(perfect_hash);
+  for (int i = 0; i < n; i++) {
+    int value;
+    CHECK(perfect_hash_get(perfect_hash, many[i], &value) && value == i);
+    free(many[i]);
+  }
+  CHECK(!perfect_hash_get(perfect_hash, "k-1", NULL));
+  perfect_hash_free(perfect_hash);
+  free(many);
+  free(many_values);
+}
+
+/*
+ * Counts the values released by test_value_types() tables.
+ */
+static int test_values_freed;
+
+static void test_value_free(void* value) {
+  (void) value;
+  test_values_freed++;
+}
+
+/*
+ * Checks inline values of a struct type and caller-owned pointer payloads,
+ * and that value_free sees every value that leaves a table.
+ */
+static void test_value_types(void) {
+  struct point {
+    double x;
+    double y;
+    char label[8];
+  };
+  struct hash_table_config config = { 0 };
+  config.array_size = 4;
+  config.value_size = sizeof(struct point);
+  config.value_free = test_value_free;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    struct point point = { i, -i, "" };
+    snprintf(point.label, sizeof(point.label), "p%d", i);
+    hash_table_add_value(hash_table, TEST_NAMES[i], &point);
+  }
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    struct point* point = hash_table_lookup(hash_table, TEST_NAMES[i]);
+    char label[8];
+    snprintf(label, sizeof(label), "p%d", i);
+    CHECK(point && point->x == i && point->y == -i && strcmp(point->label, label) == 0);
+  }
+  CHECK(hash_table_lookup(hash_table, "bananas") == NULL);
+  test_values_freed = 0;
+  CHECK(hash_table_remove(hash_table, "milk"));
+  CHECK(test_values_freed == 1);
+  hash_table_reset(hash_table);
+  CHECK(test_values_freed == NUM_TESTING_PRODUCTS);
+  hash_table_free(hash_table);
+
+  config.value_size = 0;
+  config.pointer_values = 1;
+  hash_table = hash_table_create_config(&config);
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    hash_table_add_value(hash_table, TEST_NAMES[i], &TEST_INVENTORIES[i]);
+  }
+  for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+    CHECK(hash_table_lookup(hash_table, TEST_NAMES[i]) == &TEST_INVENTORIES[i]);
+  }
+  test_values_freed = 0;
+  hash_table_free(hash_table);
+  CHECK(test_values_freed == NUM_TESTING_PRODUCTS);
+}
+
+static uint64_t test_hash_int(int key) {
+  return hash_uint32((uint32_t) key);
+}
+
+HASH_TABLE_DEFINE(int_table, int, int, test_hash_int, HASH_TABLE_EQUAL)
+
+/*
+ * Checks a generated int -> int table, loaded well past one key per bucket.
+ */
+static void test_typed_table(void) {
+  struct int_table* table = int_table_create(8);
+  for (int i = 0; i < 1000; i++) {
+    int_table_add(table, i, i * 3);
+  }
+  CHECK(table->total == 1000);
+  CHECK(int_table_collisions(table) == 1000 - 8);
+  for (int i = 0; i < 1000; i++) {
+    int value;
+    CHECK(int_table_get(table, i, &value) && value == i * 3);
+  }
+  CHECK(!int_table_get(table, 1000, NULL));
+  for (int i = 0; i < 1000; i += 2) {
+    CHECK(int_table_remove(table, i));
+  }
+  CHECK(!int_table_remove(table, 0));
+  CHECK(table->total == 500);
+  for (int i = 0; i < 1000; i++) {
+    CHECK(int_table_get(table, i, NULL) == (i % 2 == 1));
+  }
+  int_table_reset(table);
+  CHECK(table->total == 0 && !int_table_get(table, 1, NULL));
+  int_table_free(table);
+}
+
+/*
+ * function2's hash as it was first written, one character at a time, with
+ * characters promoted to int.
+ */
+static uint64_t test_hash_function2(const char* key) {
+  unsigned long hash_val = 0;
+  int c;
+  while ((c = *key++)) {
+    hash_val = hash_val * 31 + c;
+  }
+  return hash_val;
+}
+
+/*
+ * Checks that hash_raw_function2(), which takes eight characters per step,
+ * and hash_batch_function2() agree with test_hash_function2() on keys of
+ * every length up to 40, made of plain ASCII, of arbitrary bytes and of
+ * bytes of 0x80 and up only, which are negative where char is signed.
+ */
+static void test_hash_function2_batch(void) {
+  enum { MAX_LEN = 40, KINDS = 4, NUM_KEYS = (MAX_LEN + 1) * KINDS };
+  char* keys[NUM_KEYS];
+  uint64_t hashes[NUM_KEYS];
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (int len = 0; len <= MAX_LEN; len++) {
+    for (int kind = 0; kind < KINDS; kind++) {
+      char* key = malloc(len + 1);
+      CHECK(key);
+      for (int i = 0; i < len; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned int byte = (unsigned int) (state >> 56);
+        switch (kind) {
+          case 0: byte = 'a' + byte % 26; break;
+          case 1: byte = 1 + byte % 255; break;
+          case 2: byte = 0x80 | byte; break;
+          default: byte = 0xff; break;
+        }
+        key[i] = (char) byte;
+      }
+      key[len] = '\0';
+      keys[len * KINDS + kind] = key;
+    }
+  }
+
+  hash_batch_function2(keys, NUM_KEYS, hashes);
+  for (int i = 0; i < NUM_KEYS; i++) {
+    uint64_t expected = test_hash_function2(keys[i]);
+    CHECK(hash_raw_function2(keys[i]) == expected);
+    CHECK(hashes[i] == expected);
+    uint64_t single;
+    hash_batch_function2(&keys[i], 1, &single);
+    CHECK(single == expected);
+  }
+  for (int i = 0; i < NUM_KEYS; i++) {
+    free(keys[i]);
+  }
+}
+
+/*
+ * Hashes every key to bucket 0, so that its chain gets long enough to be
+ * treeified.
+ */
+static size_t test_hash_zero(struct hash_table* hash_table, char* key) {
+  (void) hash_table;
+  (void) key;
+  return 0;
+}
+
+/*
+ * Removes the elements with odd values.
+ */
+static enum hash_table_visit test_remove_odd(const char* key, void* value, void* ctx) {
+  (void) key;
+  (void) ctx;
+  return *(int*) value % 2 == 1 ? HASH_TABLE_VISIT_REMOVE : HASH_TABLE_VISIT_CONTINUE;
+}
+
+/*
+ * Counts the buckets of a fast_reset table that carry the current generation.
+ */
+static size_t test_current_buckets(struct hash_table* hash_table) {
+  size_t count = 0;
+  for (size_t i = 0; i < hash_table->size; i++) {
+    count += hash_table->bucket_gen[i] == hash_table->generation;
+  }
+  return count;
+}
+
+/*
+ * Checks that iteration visits every element once, that elements can be
+ * removed along the way (also from a treeified chain), and that iterating
+ * leaves the buckets of a fast_reset table as they were.
+ */
+static void test_iterator(void) {
+  struct hash_policy policy = hash_policy_function2;
+  struct hash_table_config config = { 0 };
+  config.array_size = 16;
+  config.fast_reset = 1;
+  config.policy = &policy;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      hash_table_add(hash_table, TEST_NAMES[i], i);
+    }
+    size_t current = test_current_buckets(hash_table);
+    struct hash_table_iter iter;
+    const char* key;
+    void* value;
+    int seen = 0;
+    hash_table_iter_begin(hash_table, &iter);
+    while (hash_table_iter_next(&iter, &key, &value)) {
+      int i = *(int*) value;
+      CHECK(strcmp(key, TEST_NAMES[i]) == 0);
+      CHECK(!(seen & (1 << i)));
+      seen |= 1 << i;
+    }
+    CHECK(seen == (1 << NUM_TESTING_PRODUCTS) - 1);
+    CHECK(!hash_table_iter_next(&iter, NULL, NULL));
+    CHECK(test_current_buckets(hash_table) == current);
+    hash_table_reset(hash_table);
+  }
+  hash_table_free(hash_table);
+
+  for (int treeified = 0; treeified < 2; treeified++) {
+    policy.hash = treeified ? test_hash_zero : test_hash_length;
+    config.fast_reset = 0;
+    hash_table = hash_table_create_config(&config);
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      hash_table_add(hash_table, TEST_NAMES[i], i);
+    }
+    CHECK((hash_table->trees != NULL && hash_table->trees[0] != NULL) == treeified);
+
+    // Remove the first element of every chain, then the odd ones.
+    struct hash_table_iter iter;
+    void* value;
+    size_t last_bucket = (size_t) -1;
+    hash_table_iter_begin(hash_table, &iter);
+    while (hash_table_iter_next(&iter, NULL, &value)) {
+      if (iter.bucket != last_bucket) {
+        last_bucket = iter.bucket;
+        *(int*) value = -1;
+        hash_table_iter_remove(&iter);
+      }
+    }
+    size_t visited = hash_table->total;
+    CHECK(hash_table_foreach(hash_table, test_remove_odd, NULL) == visited);
+    size_t left = hash_table->total;
+    CHECK(left < visited);
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      int value;
+      if (hash_table_get(hash_table, TEST_NAMES[i], &value)) {
+        CHECK(value == i && i % 2 == 0);
+        left--;
+      }
+    }
+    CHECK(left == 0);
+    hash_table_free(hash_table);
+  }
+}
+
+/*
+ * Returns n keys "key0", "key1", ... with every key from repeat on repeating
+ * an earlier one.
+ */
+static char** test_make_keys(int n, int repeat) {
+  char** keys = malloc(n * sizeof(char*));
+  CHECK(keys);
+  for (int i = 0; i < n; i++) {
+    keys[i] = malloc(16);
+    CHECK(keys[i]);
+    snprintf(keys[i], 16, "key%d", i < repeat ? i : i - repeat);
+  }
+  return keys;
+}
+
+static void test_free_keys(char** keys, int n) {
+  for (int i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+}
+
+/*
+ * Removes the element whose value is value through an iterator.
+ */
+static void test_remove_value(struct hash_table* hash_table, int value) {
+  struct hash_table_iter iter;
+  void* found;
+  hash_table_iter_begin(hash_table, &iter);
+  while (hash_table_iter_next(&iter, NULL, &found)) {
+    if (*(int*) found == value) {
+      hash_table_iter_remove(&iter);
+      return;
+    }
+  }
+  CHECK(0);
+}
+
+/*
+ * Checks that each of the n keys holds its expected value, or is absent
+ * where that is -1, and that the table holds nothing else.
+ */
+static void test_expect(struct hash_table* hash_table, char** keys, const int* expected, int n) {
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    int value;
+    int present = hash_table_get(hash_table, keys[i], &value);
+    CHECK(present == (expected[i] != -1));
+    CHECK(!present || value == expected[i]);
+    total += present;
+  }
+  CHECK(hash_table->total == total);
+}
+
+/*
+ * Checks that a chain gets its tree once it holds more than
+ * CHAIN_TREEIFY_THRESHOLD (8) nodes, keeps it down to
+ * CHAIN_UNTREEIFY_THRESHOLD (6), loses it below that, and gets it back only
+ * past 8 again; lookups and removals must agree with the chain throughout.
+ */
+static void test_chain_trees(void) {
+  struct hash_policy policy = hash_policy_function2;
+  policy.hash = test_hash_zero;
+  struct hash_table_config config = { 0 };
+  config.array_size = 4;
+  config.policy = &policy;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  int n = 10;
+  char** keys = test_make_keys(n, n);
+  int expected[10];
+  for (int i = 0; i < n; i++) {
+    expected[i] = -1;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    hash_table_add(hash_table, keys[i], i);
+    expected[i] = i;
+    CHECK(bucket_tree(hash_table, 0) == NULL);
+  }
+  hash_table_add(hash_table, keys[8], 8);
+  expected[8] = 8;
+  CHECK(bucket_tree(hash_table, 0) != NULL);
+  test_expect(hash_table, keys, expected, n);
+
+  // Down to 6 nodes, from the head, the tail and the middle of the chain.
+  CHECK(hash_table_remove(hash_table, keys[8]));
+  CHECK(hash_table_remove(hash_table, keys[0]));
+  CHECK(!hash_table_remove(hash_table, keys[9]));
+  test_remove_value(hash_table, 4);
+  expected[8] = expected[0] = expected[4] = -1;
+  CHECK(bucket_tree(hash_table, 0) != NULL);
+  test_expect(hash_table, keys, expected, n);
+
+  test_remove_value(hash_table, 2);
+  expected[2] = -1;
+  CHECK(bucket_tree(hash_table, 0) == NULL);
+  test_expect(hash_table, keys, expected, n);
+
+  // Back up from 5 nodes: no tree until there are 9.
+  for (int i = 0; i <= 4; i += 2) {
+    hash_table_add(hash_table, keys[i], i);
+    expected[i] = i;
+    CHECK(bucket_tree(hash_table, 0) == NULL);
+  }
+  test_expect(hash_table, keys, expected, n);
+  hash_table_add(hash_table, keys[8], 8);
+  expected[8] = 8;
+  CHECK(bucket_tree(hash_table, 0) != NULL);
+  test_expect(hash_table, keys, expected, n);
+
+  // A key added twice is found by its latest value until that is removed.
+  hash_table_add(hash_table, keys[1], 100);
+  int value;
+  CHECK(hash_table_get(hash_table, keys[1], &value) && value == 100);
+  CHECK(hash_table_remove(hash_table, keys[1]));
+  test_expect(hash_table, keys, expected, n);
+
+  hash_table_free(hash_table);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Counts elements and sums their values from several threads at once.
+ */
+struct test_scan {
+  pthread_mutex_t lock;
+  size_t count;
+  long long sum;
+};
+
+static void test_scan_visit(const char* key, void* value, void* ctx) {
+  struct test_scan* scan = ctx;
+  CHECK(key);
+  pthread_mutex_lock(&scan->lock);
+  scan->count++;
+  scan->sum += *(int*) value;
+  pthread_mutex_unlock(&scan->lock);
+}
+
+static long long test_scan_map(const char* key, void* value, void* ctx) {
+  (void) ctx;
+  return (long long) strlen(key) * *(int*) value;
+}
+
+/*
+ * Checks that the parallel scans agree with the serial ones.
+ */
+static void test_parallel_scans(void) {
+  int n = 20000;
+  char** keys = test_make_keys(n, n);
+  struct hash_table* hash_table = hash_table_create(1000);
+  long long sum = 0;
+  long long weighted = 0;
+  for (int i = 0; i < n; i++) {
+    hash_table_add(hash_table, keys[i], i);
+    sum += i;
+    weighted += (long long) strlen(keys[i]) * i;
+  }
+
+  struct thread_pool* pool = thread_pool_create(4);
+  CHECK(thread_pool_size(pool) == 4);
+  CHECK(hash_table_parallel_sum(hash_table, pool) == sum);
+  CHECK(hash_table_parallel_reduce(hash_table, pool, test_scan_map, NULL) == weighted);
+  CHECK(hash_table_parallel_collisions(hash_table, pool) == hash_table_collisions(hash_table));
+  struct test_scan scan;
+  pthread_mutex_init(&scan.lock, NULL);
+  scan.count = 0;
+  scan.sum = 0;
+  hash_table_parallel_foreach(hash_table, pool, test_scan_visit, &scan);
+  CHECK(scan.count == (size_t) n && scan.sum == sum);
+  pthread_mutex_destroy(&scan.lock);
+
+  hash_table_parallel_free(hash_table, pool);
+  thread_pool_free(pool);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Dump sink collecting the output in a growing buffer.
+ */
+struct test_text {
+  char* data;
+  size_t len;
+};
+
+static size_t test_text_write(void* ctx, const char* buf, size_t len) {
+  struct test_text* text = ctx;
+  text->data = realloc(text->data, text->len + len);
+  CHECK(text->data);
+  memcpy(text->data + text->len, buf, len);
+  text->len += len;
+  return len;
+}
+
+/*
+ * Returns nonzero if two tables dump to the same text, i.e. hold the same
+ * elements in the same chains in the same order.
+ */
+static int test_same_table(struct hash_table* a, struct hash_table* b) {
+  struct hash_table_dump_options options = { 0 };
+  options.format = HASH_TABLE_DUMP_COMPACT;
+  struct test_text text_a = { NULL, 0 };
+  struct test_text text_b = { NULL, 0 };
+  CHECK(hash_table_dump(a, &options, test_text_write, &text_a));
+  CHECK(hash_table_dump(b, &options, test_text_write, &text_b));
+  int same = text_a.len == text_b.len && memcmp(text_a.data, text_b.data, text_a.len) == 0;
+  free(text_a.data);
+  free(text_b.data);
+  return same;
+}
+
+/*
+ * Checks that a parallel build, duplicates included, gives the table that
+ * adding the pairs in order gives, for int and inline values.
+ */
+static void test_parallel_build(void) {
+  int n = 30000;
+  char** keys = test_make_keys(n, 25000);
+  int* values = malloc(n * sizeof(int));
+  CHECK(values);
+  for (int i = 0; i < n; i++) {
+    values[i] = i;
+  }
+  struct thread_pool* pool = thread_pool_create(4);
+
+  for (int inline_values = 0; inline_values < 2; inline_values++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = 4096;
+    config.value_size = inline_values ? sizeof(int) : 0;
+    struct hash_table* serial = hash_table_create_config(&config);
+    for (int i = 0; i < n; i++) {
+      hash_table_add_value(serial, keys[i], &values[i]);
+    }
+    struct hash_table* parallel = hash_table_parallel_build(&config, pool, keys, values, n);
+    CHECK(parallel->total == (size_t) n);
+    CHECK(test_same_table(serial, parallel));
+    int* value = hash_table_lookup(parallel, "key0");
+    CHECK(value && *value == 25000);
+    hash_table_free(serial);
+    hash_table_parallel_free(parallel, pool);
+  }
+
+  thread_pool_free(pool);
+  free(values);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Returns nonzero if a keyed table's seed differs from seed.
+ */
+static int test_reseeded(struct hash_table* hash_table, const uint64_t seed[2]) {
+  return hash_table->seed[0] != seed[0] || hash_table->seed[1] != seed[1];
+}
+
+/*
+ * Checks that a keyed table reseeds when one chain grows too long: the same
+ * key added over and over collides under every seed.  A reset or a new
+ * policy starts the spacing between reseeds over, and a parallel build runs
+ * the same check once the table is filled.
+ */
+static void test_reseed(void) {
+  int n = 100;
+  char key[] = "same";
+  char** keys = malloc(n * sizeof(char*));
+  int* values = calloc(n, sizeof(int));
+  CHECK(keys && values);
+  for (int i = 0; i < n; i++) {
+    keys[i] = key;
+  }
+
+  for (int fast_reset = 0; fast_reset < 2; fast_reset++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = 64;
+    config.policy = &hash_policy_keyed;
+    config.fast_reset = fast_reset;
+    struct hash_table* hash_table = hash_table_create_config(&config);
+    for (int round = 0; round < 3; round++) {
+      uint64_t seed[2] = { hash_table->seed[0], hash_table->seed[1] };
+      for (int i = 0; i < 16; i++) {
+        hash_table_add(hash_table, keys[i], i);
+      }
+      CHECK(!test_reseeded(hash_table, seed));
+      hash_table_add(hash_table, keys[16], 16);
+      CHECK(test_reseeded(hash_table, seed) && hash_table->reseed_total == 17);
+
+      // The next reseed waits for the element count to double.
+      memcpy(seed, hash_table->seed, sizeof(seed));
+      for (int i = 17; i < 33; i++) {
+        hash_table_add(hash_table, keys[i], i);
+      }
+      CHECK(!test_reseeded(hash_table, seed));
+      hash_table_add(hash_table, keys[33], 33);
+      CHECK(test_reseeded(hash_table, seed) && hash_table->reseed_total == 34);
+      CHECK(hash_table_lookup(hash_table, keys[0]) != NULL);
+
+      if (round == 0) {
+        hash_table_reset(hash_table);
+      } else {
+        hash_table_reset(hash_table);
+        hash_table_set_policy(hash_table, &hash_policy_keyed);
+      }
+      CHECK(hash_table->total == 0 && hash_table->reseed_total == 0);
+    }
+    hash_table_free(hash_table);
+  }
+
+  struct thread_pool* pool = thread_pool_create(4);
+  struct hash_table_config config = { 0 };
+  config.array_size = 4096;
+  config.policy = &hash_policy_keyed;
+  struct hash_table* hash_table = hash_table_parallel_build(&config, pool, keys, values, n);
+  CHECK(hash_table->total == (size_t) n && hash_table->reseed_total == (size_t) n);
+  CHECK(hash_table_lookup(hash_table, keys[0]) != NULL);
+  hash_table_parallel_free(hash_table, pool);
+  thread_pool_free(pool);
+
+  free(values);
+  free(keys);
+}
+
+/*
+ * Checks that a fast_reset table is empty after each reset, including the
+ * one where the generation counter wraps, and still calls value_free for
+ * every value it drops.
+ */
+static void test_fast_reset(void) {
+  struct hash_table_config config = { 0 };
+  config.array_size = 8;
+  config.value_size = sizeof(int);
+  config.value_free = test_value_free;
+  config.fast_reset = 1;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  CHECK(hash_table->bucket_gen != NULL);
+
+  for (int round = 0; round < 4; round++) {
+    // The third reset wraps the counter around to 0.
+    if (round == 1) {
+      hash_table->generation = UINT_MAX - 1;
+    }
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      int value = i * 10 + round;
+      hash_table_add_value(hash_table, TEST_NAMES[i], &value);
+    }
+    CHECK(hash_table_remove(hash_table, TEST_NAMES[round]));
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      int* value = hash_table_lookup(hash_table, TEST_NAMES[i]);
+      CHECK(i == round ? value == NULL : value != NULL && *value == i * 10 + round);
+    }
+    test_values_freed = 0;
+    hash_table_reset(hash_table);
+    CHECK(test_values_freed == NUM_TESTING_PRODUCTS - 1);
+    CHECK(hash_table->total == 0 && hash_table_collisions(hash_table) == 0);
+    for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+      CHECK(hash_table_lookup(hash_table, TEST_NAMES[i]) == NULL);
+    }
+    CHECK(!hash_table_remove(hash_table, TEST_NAMES[0]));
+  }
+  CHECK(hash_table->generation == 1);
+  hash_table_free(hash_table);
+}
+
+/*
+ * Checks that pow2 tables round their size up and take bucket indices by
+ * mask (function1) or multiply-shift (function2), with every key findable.
+ */
+static void test_pow2(void) {
+  static const struct {
+    size_t array_size;
+    size_t size;
+  } sizes[] = { { 1, 2 }, { 2, 2 }, { 5, 8 }, { 8, 8 }, { 1000, 1024 } };
+  const struct hash_policy* policies[] = {
+    &hash_policy_function1, &hash_policy_function2, &hash_policy_keyed
+  };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+      struct hash_table_config config = { 0 };
+      config.array_size = sizes[s].array_size;
+      config.pow2 = 1;
+      config.policy = policies[p];
+      struct hash_table* hash_table = hash_table_create_config(&config);
+      CHECK(hash_table->size == sizes[s].size);
+      CHECK(hash_table->mask == hash_table->size - 1);
+      CHECK((size_t) 1 << (64 - hash_table->shift) == hash_table->size);
+
+      for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+        hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
+        uint64_t hash = hash_table_hash(hash_table, TEST_NAMES[i]);
+        size_t bucket = hash_table_bucket(hash_table, hash);
+        if (policies[p] == &hash_policy_function2) {
+          CHECK(bucket == (size_t) ((hash * UINT64_C(0x9E3779B97F4A7C15)) >> hash_table->shift));
+        } else {
+          CHECK(bucket == (hash & hash_table->mask));
+        }
+        CHECK(bucket_head(hash_table, bucket) != NULL);
+      }
+      for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+        int inventory;
+        CHECK(hash_table_get(hash_table, TEST_NAMES[i], &inventory));
+        CHECK(inventory == TEST_INVENTORIES[i]);
+      }
+      hash_table_free(hash_table);
+    }
+  }
+}
+
+/*
+ * Checks that page_alloc() honours every huge page and NUMA option with a
+ * zero-filled block of the right size and alignment, and that tables using
+ * them work, fast_reset included.
+ */
+static void test_pages(void) {
+  static const struct page_options options[] = {
+    { PAGE_HUGE_NONE, PAGE_NUMA_DEFAULT },
+    { PAGE_HUGE_NONE, PAGE_NUMA_LOCAL },
+    { PAGE_HUGE_NONE, PAGE_NUMA_INTERLEAVE },
+    { PAGE_HUGE_TRANSPARENT, PAGE_NUMA_DEFAULT },
+    { PAGE_HUGE_EXPLICIT, PAGE_NUMA_LOCAL },
+  };
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+    size_t size = 3 * page + 5;
+    size_t mapped;
+    unsigned char* block = page_alloc(size, &options[o], &mapped);
+    CHECK(block);
+    if (!page_options_set(&options[o])) {
+      CHECK(mapped == 0);
+    } else {
+      size_t align = options[o].huge != PAGE_HUGE_NONE ? PAGE_HUGE_SIZE : page;
+      CHECK(mapped >= size && mapped % align == 0);
+      CHECK(options[o].huge == PAGE_HUGE_NONE || (uintptr_t) block % PAGE_HUGE_SIZE == 0);
+    }
+    for (size_t i = 0; i < size; i++) {
+      CHECK(block[i] == 0);
+    }
+    memset(block, 0xff, size);
+    page_free(block, mapped);
+
+    for (int fast_reset = 0; fast_reset < 2; fast_reset++) {
+      struct hash_table_config config = { 0 };
+      config.array_size = 1000;
+      config.pages = options[o];
+      config.fast_reset = fast_reset;
+      struct hash_table* hash_table = hash_table_create_config(&config);
+      for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+          hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i] + round);
+        }
+        for (int i = 0; i < NUM_TESTING_PRODUCTS; i++) {
+          int inventory;
+          CHECK(hash_table_get(hash_table, TEST_NAMES[i], &inventory));
+          CHECK(inventory == TEST_INVENTORIES[i] + round);
+        }
+        hash_table_reset(hash_table);
+        CHECK(!hash_table_get(hash_table, TEST_NAMES[0], NULL));
+      }
+      hash_table_free(hash_table);
+    }
+  }
+}
+
+/*
+ * A custom hash: a bucket index for the table's current size, so that it
+ * changes whenever the table grows.
+ */
+static size_t test_hash_custom(struct hash_table* hash_table, char* key) {
+  return perfect_hash_key(key, 0) % hash_table->size;
+}
+
+static enum hash_table_visit test_remove_multiple_of_3(const char* key, void* value, void* ctx) {
+  (void) key;
+  (void) ctx;
+  return *(int*) value % 3 == 0 ? HASH_TABLE_VISIT_REMOVE : HASH_TABLE_VISIT_CONTINUE;
+}
+
+/*
+ * Grows a table of the given backend from 4 buckets or slots to thousands,
+ * with a built-in and a custom policy, and checks lookups, removals and
+ * iteration along the way.
+ */
+static void test_backend(enum hash_table_backend backend) {
+  int n = 5000;
+  char** keys = test_make_keys(n, n);
+  char* seen = malloc(n);
+  CHECK(seen);
+  struct hash_policy custom = hash_policy_function2;
+  custom.hash = test_hash_custom;
+  const struct hash_policy* policies[] = { &hash_policy_function2, &custom };
+
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = 4;
+    config.backend = backend;
+    config.policy = policies[p];
+    struct hash_table* hash_table = hash_table_create_config(&config);
+    CHECK(hash_table->array == NULL);
+    for (int i = 0; i < n; i++) {
+      hash_table_add(hash_table, keys[i], i);
+      // Everything added so far must survive each grow.
+      if ((i & (i - 1)) == 0) {
+        for (int j = 0; j <= i; j++) {
+          int value;
+          CHECK(hash_table_get(hash_table, keys[j], &value) && value == j);
+        }
+      }
+    }
+    CHECK(hash_table->size > 4 && hash_table->total == (size_t) n);
+
+    CHECK(hash_table_remove(hash_table, keys[1]));
+    CHECK(!hash_table_remove(hash_table, keys[1]));
+    CHECK(hash_table_foreach(hash_table, test_remove_multiple_of_3, NULL) == (size_t) n - 1);
+    memset(seen, 0, n);
+    struct hash_table_iter iter;
+    void* value;
+    size_t count = 0;
+    hash_table_iter_begin(hash_table, &iter);
+    while (hash_table_iter_next(&iter, NULL, &value)) {
+      int i = *(int*) value;
+      CHECK(i % 3 != 0 && i != 1 && !seen[i]);
+      seen[i] = 1;
+      count++;
+    }
+    CHECK(count == hash_table->total);
+    for (int i = 0; i < n; i++) {
+      int value;
+      int present = hash_table_get(hash_table, keys[i], &value);
+      CHECK(present == (i % 3 != 0 && i != 1));
+      CHECK(!present || value == i);
+    }
+    hash_table_free(hash_table);
+  }
+  free(seen);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Checks a table's counting filter: it never rules out a key that is in the
+ * table, and it forgets removed keys, so that lookups of most of them stop
+ * at the filter.
+ */
+static void test_filter_table(enum hash_table_backend backend, const struct hash_policy* policy,
+                              int exact) {
+  int n = 4000;
+  char** keys = test_make_keys(n, n);
+  uint64_t* filter_hashes = malloc(n * sizeof(uint64_t));
+  CHECK(filter_hashes);
+  struct hash_table_config config = { 0 };
+  config.array_size = backend == HASH_TABLE_CHAINED ? (size_t) n : 4;
+  config.backend = backend;
+  config.policy = policy;
+  config.filter_capacity = n;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  CHECK(hash_table->filter != NULL);
+  for (int i = 0; i < n; i++) {
+    hash_table_add(hash_table, keys[i], i);
+  }
+
+  // Filter hashes are taken once every grow is done.
+  struct hash_table_iter iter;
+  const char* key;
+  void* value;
+  hash_table_iter_begin(hash_table, &iter);
+  while (hash_table_iter_next(&iter, &key, &value)) {
+    filter_hashes[*(int*) value] = hash_table_filter_hash(hash_table, iter.node->hash, key);
+  }
+
+  CHECK(hash_table_remove(hash_table, keys[1]));
+  CHECK(!hash_table_remove(hash_table, keys[1]));
+  CHECK(hash_table_foreach(hash_table, test_remove_odd, NULL) == (size_t) n - 1);
+  CHECK(hash_table->total == (size_t) n / 2);
+  int passed = 0;
+  for (int i = 0; i < n; i++) {
+    int present = hash_table_get(hash_table, keys[i], NULL);
+    CHECK(present == (i % 2 == 0));
+    if (present) {
+      CHECK(bloom_maybe(hash_table->filter, filter_hashes[i]));
+    } else {
+      passed += bloom_maybe(hash_table->filter, filter_hashes[i]) != 0;
+    }
+  }
+  if (exact) {
+    CHECK(passed < n / 2 / 20);
+  }
+
+  // Removed keys can come back.
+  for (int i = 1; i < n; i += 2) {
+    hash_table_add(hash_table, keys[i], i);
+  }
+  for (int i = 0; i < n; i++) {
+    int found;
+    CHECK(hash_table_get(hash_table, keys[i], &found) && found == i);
+  }
+  hash_table_free(hash_table);
+  free(filter_hashes);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Runs test_filter_table() over every backend and policy.  Custom hashes
+ * return bucket indices, which many keys share, so the filter only forgets
+ * them exactly with the built-in hashes.
+ */
+static void test_filter(void) {
+  struct hash_policy custom = hash_policy_function2;
+  custom.hash = test_hash_custom;
+  enum hash_table_backend backends[] = { HASH_TABLE_CHAINED, HASH_TABLE_CUCKOO, HASH_TABLE_HOPSCOTCH };
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+    test_filter_table(backends[b], &hash_policy_function1, 1);
+    test_filter_table(backends[b], &hash_policy_function2, 1);
+    test_filter_table(backends[b], &custom, 0);
+  }
+}
+
+/*
+ * Key equality that counts its calls.
+ */
+static int test_equal_calls;
+
+static int test_equal_counted(const char* a, const char* b) {
+  test_equal_calls++;
+  return strcmp(a, b) == 0;
+}
+
+/*
+ * Checks that removals and lookups compare cached hashes before keys: with
+ * every key in one chain (or with a cuckoo or hopscotch table), finding a key
+ * compares it with no other key, and looking for an absent one compares
+ * nothing.
+ */
+static void test_hash_first(void) {
+  int n = 50;
+  char** keys = test_make_keys(n, n);
+  struct hash_policy policy = hash_policy_function2;
+  policy.equal = test_equal_counted;
+  enum hash_table_backend backends[] = { HASH_TABLE_CHAINED, HASH_TABLE_CUCKOO, HASH_TABLE_HOPSCOTCH };
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = 1;
+    config.policy = &policy;
+    config.backend = backends[b];
+    struct hash_table* hash_table = hash_table_create_config(&config);
+    for (int i = 0; i < n - 1; i++) {
+      hash_table_add(hash_table, keys[i], i);
+    }
+
+    // keys[0] went in first, so it is at the end of the chain.
+    test_equal_calls = 0;
+    CHECK(hash_table_get(hash_table, keys[0], NULL));
+    CHECK(test_equal_calls == 1);
+    test_equal_calls = 0;
+    CHECK(hash_table_remove(hash_table, keys[0]));
+    CHECK(test_equal_calls == 1);
+    test_equal_calls = 0;
+    CHECK(!hash_table_remove(hash_table, keys[n - 1]));
+    CHECK(!hash_table_get(hash_table, keys[0], NULL));
+    CHECK(test_equal_calls == 0);
+    CHECK(hash_table->total == (size_t) n - 2);
+    hash_table_free(hash_table);
+  }
+  test_free_keys(keys, n);
+}
+
+/*
+ * Interns and releases every key of a test_intern_job from one thread.
+ */
+struct test_intern_job {
+  struct intern_pool* pool;
+  char** keys;
+  int n;
+};
+
+static void* test_intern_thread(void* arg) {
+  struct test_intern_job* job = arg;
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < job->n; i++) {
+      char* key = intern_pool_intern(job->pool, job->keys[i]);
+      CHECK(strcmp(key, job->keys[i]) == 0);
+      intern_pool_release(job->pool, key);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Checks that two tables interning into one pool share their copies of equal
+ * keys, and that a copy lives until the last table holding the key lets go
+ * of it.  Then has several threads intern and release the same keys at once.
+ */
+static void test_intern(void) {
+  int n = 1000;
+  char** keys = test_make_keys(n, n);
+  struct intern_pool* pool = intern_pool_create();
+  struct hash_policy policy = hash_policy_function2;
+  hash_policy_intern(&policy, pool);
+  struct hash_table_config config = { 0 };
+  config.array_size = 64;
+  config.policy = &policy;
+  struct hash_table* first = hash_table_create_config(&config);
+  struct hash_table* second = hash_table_create_config(&config);
+
+  // first holds the even keys, second the keys below n / 2.
+  for (int i = 0; i < n; i += 2) {
+    hash_table_add(first, keys[i], i);
+  }
+  for (int i = 0; i < n / 2; i++) {
+    hash_table_add(second, keys[i], i);
+  }
+  CHECK(intern_pool_size(pool) == (size_t) n / 2 + n / 4);
+  struct hash_table_iter iter;
+  const char* key;
+  hash_table_iter_begin(first, &iter);
+  while (hash_table_iter_next(&iter, &key, NULL)) {
+    CHECK(intern_pool_find(pool, key) == key);
+  }
+  hash_table_iter_begin(second, &iter);
+  while (hash_table_iter_next(&iter, &key, NULL)) {
+    CHECK(intern_pool_find(pool, key) == key);
+  }
+
+  // Releasing the odd keys of second drops them from the pool; the even
+  // ones are still held by first.
+  CHECK(hash_table_foreach(second, test_remove_odd, NULL) == (size_t) n / 2);
+  CHECK(intern_pool_size(pool) == (size_t) n / 2);
+  hash_table_free(first);
+  CHECK(intern_pool_size(pool) == (size_t) n / 4);
+  for (int i = 0; i < n; i++) {
+    const char* copy = intern_pool_find(pool, keys[i]);
+    CHECK((copy != NULL) == (i < n / 2 && i % 2 == 0));
+    CHECK(copy == NULL || strcmp(copy, keys[i]) == 0);
+  }
+  hash_table_free(second);
+  CHECK(intern_pool_size(pool) == 0);
+
+  enum { NUM_THREADS = 4 };
+  pthread_t threads[NUM_THREADS];
+  struct test_intern_job job = { pool, keys, n };
+  for (int i = 0; i < NUM_THREADS; i++) {
+    CHECK(pthread_create(&threads[i], NULL, test_intern_thread, &job) == 0);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  CHECK(intern_pool_size(pool) == 0);
+
+  intern_pool_free(pool);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Checks that a table with borrowed keys stores the caller's key pointers
+ * themselves, finds them by content, and never frees them: the keys are
+ * freed by the test afterwards, which the sanitizers would flag if the table
+ * had freed any of them.  Covers every backend, the arena of fast_reset
+ * tables and parallel builds.
+ */
+static void test_borrowed_keys(void) {
+  int n = 2000;
+  char** keys = test_make_keys(n, n);
+  int* values = malloc(n * sizeof(int));
+  CHECK(values);
+  for (int i = 0; i < n; i++) {
+    values[i] = i;
+  }
+  struct hash_policy policy = hash_policy_function2;
+  hash_policy_borrow(&policy);
+  struct thread_pool* pool = thread_pool_create(4);
+
+  for (int variant = 0; variant < 5; variant++) {
+    struct hash_table_config config = { 0 };
+    config.array_size = 64;
+    config.policy = &policy;
+    config.backend = variant == 1 ? HASH_TABLE_CUCKOO
+                   : variant == 2 ? HASH_TABLE_HOPSCOTCH : HASH_TABLE_CHAINED;
+    config.fast_reset = variant == 3;
+    struct hash_table* hash_table;
+    if (variant == 4) {
+      hash_table = hash_table_parallel_build(&config, pool, keys, values, n);
+    } else {
+      hash_table = hash_table_create_config(&config);
+      for (int i = 0; i < n; i++) {
+        hash_table_add(hash_table, keys[i], i);
+      }
+    }
+
+    struct hash_table_iter iter;
+    const char* key;
+    void* value;
+    size_t count = 0;
+    hash_table_iter_begin(hash_table, &iter);
+    while (hash_table_iter_next(&iter, &key, &value)) {
+      CHECK(key == keys[*(int*) value]);
+      count++;
+    }
+    CHECK(count == (size_t) n);
+    char copy[16];
+    snprintf(copy, sizeof(copy), "%s", keys[7]);
+    int* found = hash_table_lookup(hash_table, copy);
+    CHECK(found && *found == 7);
+
+    CHECK(hash_table_foreach(hash_table, test_remove_odd, NULL) == (size_t) n);
+    CHECK(hash_table->total == (size_t) n / 2);
+    if (variant == 4) {
+      hash_table_parallel_free(hash_table, pool);
+      continue;
+    }
+    hash_table_reset(hash_table);
+    CHECK(hash_table->total == 0);
+    for (int i = 0; i < n; i++) {
+      hash_table_add(hash_table, keys[i], i);
+    }
+    found = hash_table_lookup(hash_table, copy);
+    CHECK(found && *found == 7);
+    hash_table_free(hash_table);
+  }
+
+  thread_pool_free(pool);
+  free(values);
+  test_free_keys(keys, n);
+}
+
+/*
+ * Checks the cuckoo backend, and that growing shows in its counters.
+ */
+static void test_cuckoo(void) {
+  test_backend(HASH_TABLE_CUCKOO);
+
+  struct hash_table_config config = { 0 };
+  config.array_size = 4;
+  config.backend = HASH_TABLE_CUCKOO;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  struct hash_table_cuckoo_stats stats;
+  CHECK(hash_table_cuckoo_stats(hash_table, &stats) && stats.buckets == 4 && stats.grows == 0);
+  char** keys = test_make_keys(1000, 1000);
+  for (int i = 0; i < 1000; i++) {
+    hash_table_add(hash_table, keys[i], i);
+  }
+  CHECK(hash_table_cuckoo_stats(hash_table, &stats));
+  CHECK(stats.buckets == hash_table->size && stats.buckets >= 1000 / 4 && stats.grows > 0);
+  hash_table_free(hash_table);
+  test_free_keys(keys, 1000);
+}
+
+/*
+ * Checks the hopscotch backend.
+ */
+static void test_hopscotch(void) {
+  test_backend(HASH_TABLE_HOPSCOTCH);
+
+  struct hash_table_config config = { 0 };
+  config.array_size = 4;
+  config.backend = HASH_TABLE_HOPSCOTCH;
+  struct hash_table* hash_table = hash_table_create_config(&config);
+  struct hash_table_cuckoo_stats stats;
+  CHECK(!hash_table_cuckoo_stats(hash_table, &stats));
+  hash_table_free(hash_table);
+}
+
 int main(int argc, char** argv) {
   int array_size = 8;
 
   struct hash_table* hash_table = hash_table_create(array_size);
+  hash_table_set_policy(hash_table, &hash_policy_function1);
 
   /*
    *  FIRST, how does it perform using hash_function1() ? 
    */
 
   for(int i=0; i<NUM_TESTING_PRODUCTS; i++) {
-    hash_table_add(hash_table, hash_function1, TEST_NAMES[i], TEST_INVENTORIES[i]);
+    hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
   }
 
   int num_col1 = hash_table_collisions(hash_table);
@@ -67,6 +1463,7 @@ int main(int argc, char** argv) {
   display(hash_table);
 
   hash_table_reset(hash_table);
+  hash_table_set_policy(hash_table, &hash_policy_function2);
   
 
   /*
@@ -77,7 +1474,7 @@ int main(int argc, char** argv) {
    */
 
   for(int i=0; i<NUM_TESTING_PRODUCTS; i++) {
-    hash_table_add(hash_table, hash_function2, TEST_NAMES[i], TEST_INVENTORIES[i]);
+    hash_table_add(hash_table, TEST_NAMES[i], TEST_INVENTORIES[i]);
   }
 
   int num_col2 = hash_table_collisions(hash_table);
@@ -87,8 +1484,61 @@ int main(int argc, char** argv) {
 
   printf("As an example of removal, here is the\n");
   printf("final hash table with %s removed\n\n",TEST_NAMES[9]);
-  hash_table_remove(hash_table, hash_function2, TEST_NAMES[9]);
+  hash_table_remove(hash_table, TEST_NAMES[9]);
   display(hash_table);
 
+  /*
+   *  THIRD, the product names are a fixed set, so they can also be placed in
+   *  a minimal perfect hash table, which has no collisions at all.
+   */
+
+  struct perfect_hash* perfect_hash = perfect_hash_build(TEST_NAMES, TEST_INVENTORIES, NUM_TESTING_PRODUCTS);
+  CHECK(perfect_hash);
+  printf("Found %zu collisions for perfect_hash_build()\n", perfect_hash_collisions(perfect_hash));
+  for(int i=0; i<NUM_TESTING_PRODUCTS; i++) {
+    int inventory;
+    CHECK(perfect_hash_get(perfect_hash, TEST_NAMES[i], &inventory));
+    CHECK(inventory == TEST_INVENTORIES[i]);
+  }
+  perfect_hash_free(perfect_hash);
+
+  /*
+   *  The same table generated at build time from products.txt needs no
+   *  construction at all.
+   */
+
+  for(int i=0; i<NUM_TESTING_PRODUCTS; i++) {
+    int inventory;
+    CHECK(products_get(TEST_NAMES[i], &inventory));
+    CHECK(inventory == TEST_INVENTORIES[i]);
+  }
+  CHECK(!products_get("bananas", NULL));
+
   hash_table_free(hash_table);
+
+  /*
+   *  Finally, the features built on top of the basic table.
+   */
+
+  test_value_types();
+  test_typed_table();
+  test_hash_function2_batch();
+  test_iterator();
+  test_chain_trees();
+  test_fast_reset();
+  test_pow2();
+  test_pages();
+  test_cuckoo();
+  test_hopscotch();
+  test_filter();
+  test_hash_first();
+  test_intern();
+  test_borrowed_keys();
+  test_dump();
+  test_parallel_scans();
+  test_parallel_build();
+  test_reseed();
+  test_snapshot();
+  test_frozen();
+  test_perfect_hash();
 }
@@ -0,0 +1,156 @@
+/*
+ * This file contains the definitions of structures and functions implementing
+ * a simple thread pool on top of POSIX threads.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // for pthreads and sysconf()
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+/*
+ * Definition of the thread_pool structure.
+ *
+ * The current job is described by task/ctx/num_tasks; next_task is the next
+ * index to hand out and done_tasks counts finished ones.  generation changes
+ * with every job so that sleeping workers can tell a new job from a spurious
+ * wakeup.  Everything is protected by lock.
+ */
+struct thread_pool {
+  pthread_t* threads;
+  int num_workers;
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  unsigned long generation;
+  int shutdown;
+  void (*task)(void* ctx, int index);
+  void* ctx;
+  int num_tasks;
+  int next_task;
+  int done_tasks;
+};
+
+/*
+ * Claims and runs tasks of the current job until none are left.  Called with
+ * the lock held; returns with the lock held.
+ */
+static void thread_pool_work(struct thread_pool* pool) {
+  while (pool->next_task < pool->num_tasks) {
+    int index = pool->next_task++;
+    void (*task)(void*, int) = pool->task;
+    void* ctx = pool->ctx;
+    pthread_mutex_unlock(&pool->lock);
+    task(ctx, index);
+    pthread_mutex_lock(&pool->lock);
+    if (++pool->done_tasks == pool->num_tasks) {
+      pthread_cond_broadcast(&pool->work_done);
+    }
+  }
+}
+
+/*
+ * Main loop of a worker thread.
+ */
+static void* thread_pool_worker(void* arg) {
+  struct thread_pool* pool = arg;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && !pool->shutdown) {
+      pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->generation;
+    thread_pool_work(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*
+ * Creates a pool and starts its workers.
+ */
+struct thread_pool* thread_pool_create(int num_threads) {
+  if (num_threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cpus > 0 ? (int) cpus : 1;
+  }
+  struct thread_pool* pool = malloc(sizeof(struct thread_pool));
+  assert(pool);
+  pool->num_workers = num_threads - 1;
+  pool->threads = malloc((pool->num_workers > 0 ? pool->num_workers : 1) * sizeof(pthread_t));
+  assert(pool->threads);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->work_done, NULL);
+  pool->generation = 0;
+  pool->shutdown = 0;
+  pool->task = NULL;
+  pool->ctx = NULL;
+  pool->num_tasks = 0;
+  pool->next_task = 0;
+  pool->done_tasks = 0;
+  for (int i = 0; i < pool->num_workers; i++) {
+    int rc = pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool);
+    assert(rc == 0);
+    (void) rc;
+  }
+  return pool;
+}
+
+/*
+ * Stops and joins the workers, then frees the pool.
+ */
+void thread_pool_free(struct thread_pool* pool) {
+  assert(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->num_workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_cond_destroy(&pool->work_done);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
+
+int thread_pool_size(struct thread_pool* pool) {
+  assert(pool);
+  return pool->num_workers + 1;
+}
+
+/*
+ * Publishes a job, works on it alongside the workers, and waits for the
+ * tasks still running elsewhere.
+ */
+void thread_pool_run(struct thread_pool* pool, void (*task)(void* ctx, int index),
+                     void* ctx, int num_tasks) {
+  assert(pool);
+  assert(task);
+  if (num_tasks <= 0) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->ctx = ctx;
+  pool->num_tasks = num_tasks;
+  pool->next_task = 0;
+  pool->done_tasks = 0;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_ready);
+  thread_pool_work(pool);
+  while (pool->done_tasks < pool->num_tasks) {
+    pthread_cond_wait(&pool->work_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,51 @@
+/*
+ * This file contains the definition of an interface for a fixed pool of
+ * worker threads that run data-parallel jobs: a job is a function applied to
+ * task indices 0 .. num_tasks - 1, spread over the workers.
+ */
+
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+/*
+ * Structure used to represent a thread pool.
+ */
+struct thread_pool;
+
+/*
+ * Creates a pool of worker threads.
+ *
+ * Params:
+ *   num_threads - the number of threads that run jobs, counting the thread
+ *     that calls thread_pool_run().  0 or less means one per online CPU.
+ */
+struct thread_pool* thread_pool_create(int num_threads);
+
+/*
+ * Stops the workers and frees all of the memory associated with a pool.
+ *
+ * Params:
+ *   pool - the pool to be destroyed.  May not be NULL.  No job may be running.
+ */
+void thread_pool_free(struct thread_pool* pool);
+
+/*
+ * Returns the number of threads that run jobs, including the caller.
+ */
+int thread_pool_size(struct thread_pool* pool);
+
+/*
+ * Runs task(ctx, i) for every i in [0, num_tasks) on the pool and the
+ * calling thread, and returns once all of them have finished.  Tasks are
+ * handed out one at a time, so uneven tasks balance out.
+ *
+ * Params:
+ *   pool - the pool to run on.  May not be NULL.
+ *   task - the function to apply to each task index
+ *   ctx - opaque pointer passed through to task
+ *   num_tasks - the number of task indices
+ */
+void thread_pool_run(struct thread_pool* pool, void (*task)(void* ctx, int index),
+                     void* ctx, int num_tasks);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * This file contains macros that generate hash tables specialized on their
+ * key and value types, for keys that are not strings (e.g. 64-bit ids).
+ *
+ * The generated tables use the same algorithms as hash_table.c (an array of
+ * singly-linked chains, new nodes inserted at the head of their bucket, the
+ * same collision count), but keys are stored by value, hashed with an
+ * integer mixer and compared directly, so there is no string formatting,
+ * copying or strcmp anywhere.
+ *
+ * Usage:
+ *
+ *   HASH_TABLE_DEFINE(id_table, uint64_t, int, hash_uint64, HASH_TABLE_EQUAL)
+ *
+ * defines struct id_table plus id_table_create(), id_table_free(),
+ * id_table_reset(), id_table_add(), id_table_remove(), id_table_get() and
+ * id_table_collisions(), each behaving like its hash_table_* counterpart.
+ */
+
+#ifndef __TYPED_HASH_TABLE_H
+#define __TYPED_HASH_TABLE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * Integer hash functions: the splitmix64 / murmur3 finalizers.  Every input
+ * bit affects every output bit, so sequential ids spread over all buckets.
+ */
+static inline uint64_t hash_uint64(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+static inline uint64_t hash_uint32(uint32_t key) {
+  uint32_t h = key;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return ((uint64_t) h << 32) | h;
+}
+
+/*
+ * Key equality for scalar keys.
+ */
+#define HASH_TABLE_EQUAL(a, b) ((a) == (b))
+
+/*
+ * Maps a 64-bit hash onto [0, size) with a multiply-shift (no division).
+ * Sizes beyond 32 bits, which the shift cannot scale to, take a modulo.
+ */
+static inline size_t typed_hash_reduce(uint64_t hash, size_t size) {
+  if (size <= UINT32_MAX) {
+    return (size_t) (((hash >> 32) * (uint64_t) size) >> 32);
+  }
+  return (size_t) (hash % size);
+}
+
+/*
+ * Generates the table type "name" with keys of key_type and values of
+ * value_type.  hash_fn(key) must return a uint64_t; equal_fn(a, b) must
+ * return nonzero when two keys are equal.
+ */
+#define HASH_TABLE_DEFINE(name, key_type, value_type, hash_fn, equal_fn)        \
+                                                                                \
+struct name##_node {                                                            \
+  key_type key;                                                                 \
+  value_type value;                                                             \
+  struct name##_node* next;                                                     \
+};                                                                              \
+                                                                                \
+struct name {                                                                   \
+  struct name##_node** array;                                                   \
+  size_t size;                                                                  \
+  size_t total;                                                                 \
+};                                                                              \
+                                                                                \
+static inline struct name* name##_create(size_t array_size) {                  \
+  assert(array_size > 0);                                                       \
+  struct name* table = malloc(sizeof(struct name));                             \
+  assert(table);                                                                \
+  table->size = array_size;                                                     \
+  table->total = 0;                                                             \
+  table->array = calloc(array_size, sizeof(struct name##_node*));               \
+  assert(table->array);                                                         \
+  return table;                                                                 \
+}                                                                               \
+                                                                                \
+static inline void name##_reset(struct name* table) {                          \
+  assert(table);                                                                \
+  for (size_t i = 0; i < table->size; i++) {                                    \
+    struct name##_node* current = table->array[i];                              \
+    while (current != NULL) {                                                   \
+      struct name##_node* next = current->next;                                 \
+      free(current);                                                            \
+      current = next;                                                           \
+    }                                                                           \
+    table->array[i] = NULL;                                                     \
+  }                                                                             \
+  table->total = 0;                                                             \
+}                                                                               \
+                                                                                \
+static inline void name##_free(struct name* table) {                           \
+  assert(table);                                                                \
+  name##_reset(table);                                                          \
+  free(table->array);                                                           \
+  free(table);                                                                  \
+}                                                                               \
+                                                                                \
+static inline void name##_add(struct name* table, key_type key,                \
+                              value_type value) {                               \
+  assert(table);                                                                \
+  struct name##_node* new_node = malloc(sizeof(struct name##_node));            \
+  assert(new_node);                                                             \
+  new_node->key = key;                                                          \
+  new_node->value = value;                                                      \
+  size_t index = typed_hash_reduce(hash_fn(key), table->size);                 \
+  new_node->next = table->array[index];                                         \
+  table->array[index] = new_node;                                               \
+  table->total++;                                                               \
+}                                                                               \
+                                                                                \
+static inline int name##_remove(struct name* table, key_type key) {            \
+  assert(table);                                                                \
+  size_t index = typed_hash_reduce(hash_fn(key), table->size);                 \
+  struct name##_node** link = &table->array[index];                             \
+  for (; *link != NULL; link = &(*link)->next) {                                \
+    if (equal_fn((*link)->key, key)) {                                          \
+      struct name##_node* found = *link;                                        \
+      *link = found->next;                                                      \
+      free(found);                                                              \
+      table->total--;                                                           \
+      return 1;                                                                 \
+    }                                                                           \
+  }                                                                             \
+  return 0;                                                                     \
+}                                                                               \
+                                                                                \
+static inline int name##_get(struct name* table, key_type key,                 \
+                             value_type* value) {                               \
+  assert(table);                                                                \
+  size_t index = typed_hash_reduce(hash_fn(key), table->size);                 \
+  for (struct name##_node* temp = table->array[index]; temp != NULL;            \
+       temp = temp->next) {                                                     \
+    if (equal_fn(temp->key, key)) {                                             \
+      if (value != NULL) {                                                      \
+        *value = temp->value;                                                   \
+      }                                                                         \
+      return 1;                                                                 \
+    }                                                                           \
+  }                                                                             \
+  return 0;                                                                     \
+}                                                                               \
+                                                                                \
+static inline size_t name##_collisions(struct name* table) {                   \
+  assert(table);                                                                \
+  size_t num_col = 0;                                                           \
+  for (size_t i = 0; i < table->size; i++) {                                    \
+    size_t count = 0;                                                           \
+    for (struct name##_node* temp = table->array[i]; temp != NULL;              \
+         temp = temp->next) {                                                   \
+      count++;                                                                  \
+    }                                                                           \
+    if (count > 1) {                                                            \
+      num_col += count - 1;                                                     \
+    }                                                                           \
+  }                                                                             \
+  return num_col;                                                               \
+}
+
+#endif